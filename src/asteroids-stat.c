@@ -0,0 +1,104 @@
+/*
+ *	asteroids-stat.c
+ *   Attach to a running game's telemetry and print its live statistics.
+ *
+ *   usage: asteroids-stat [-i ms] [-1] pid|name
+ *  -i ms   refresh interval (default 1000)
+ *  -1      print once and exit
+ *   'pid' is the game's process id; 'name' a shared memory object name as
+ *   given to the game's -telemetry option.  Exits once the game has.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "telemetry.h"
+
+int main(int argc, char *argv[])
+{
+    const TelemetryStats *shared;
+    TelemetryStats s;
+    struct timespec ts;
+    char name[256];
+    int i, fd, interval = 1000, once = 0;
+    const char *target = NULL;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-i") == 0 && i + 1 < argc)
+            interval = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-1") == 0)
+            once = 1;
+        else
+            target = argv[i];
+    }
+    if (!target || interval <= 0)
+    {
+        fprintf(stderr, "usage: asteroids-stat [-i ms] [-1] pid|name\n");
+        return 1;
+    }
+
+    if (isdigit((unsigned char)target[0]))
+        snprintf(name, sizeof(name), TELEMETRY_NAME, atoi(target));
+    else
+        snprintf(name, sizeof(name), "%s%s", target[0] == '/' ? "" : "/", target);
+
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+    {
+        perror(name);
+        return 1;
+    }
+    shared = mmap(NULL, sizeof(TelemetryStats), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shared == MAP_FAILED)
+    {
+        perror("mmap");
+        return 1;
+    }
+    if (shared->magic != TELEMETRY_MAGIC || shared->version != TELEMETRY_VERSION ||
+        shared->size != sizeof(TelemetryStats))
+    {
+        fprintf(stderr, "%s: unsupported telemetry layout (version %u)\n",
+                name, (unsigned int)shared->version);
+        return 1;
+    }
+
+    ts.tv_sec = interval / 1000;
+    ts.tv_nsec = (long)(interval % 1000) * 1000000L;
+
+    printf("%10s %7s %7s %7s %6s %15s %15s %6s %10s %8s %12s\n", "tick", "tick/s",
+           "tick ms", "frame", "detail", "asteroids", "photons", "kills",
+           "pairs", "hits", "capture");
+    for (;;)
+    {
+        telemetryRead(shared, &s);
+        /* the block outlives its game while mapped here; EPERM still
+           means the process exists */
+        if (kill((pid_t)s.pid, 0) != 0 && errno == ESRCH)
+        {
+            fprintf(stderr, "%s: game %u has exited\n", name, (unsigned int)s.pid);
+            return 0;
+        }
+        printf("%10llu %7.1f %7.3f %7.3f %5.0f%% %7u/%-7u %7u/%-7u %6d %10llu %8llu %5u/%-2u %4llu\n",
+               (unsigned long long)s.tick, s.tickRate, s.tickTime, s.frameTime,
+               s.detail * 100.0, s.asteroidsActive, s.asteroids, s.photonsActive,
+               s.photons, s.killCount, (unsigned long long)s.collisionPairs,
+               (unsigned long long)s.collisionHits, s.captureQueued,
+               s.captureQueueSize, (unsigned long long)s.captureDropped);
+        fflush(stdout);
+        if (once)
+            break;
+        nanosleep(&ts, NULL);
+    }
+
+    return 0;
+}
@@ -10,19 +10,63 @@
  *  'a' changes circles to asteroids
  *  'p' slows the game for debugging
  *  'r' resumes game speed
+ *  'f' toggles the frame statistics overlay
+ *  'b' cycles asteroid behaviour: drift, flock, separate, home
  *  'q' quit
  *   An asteroids game for CSCI3161 based on provided skeleton code.
  *	 original author: Dirk Arnold
  *   additions by: Richard Purcell B00647567
+ *
+ *   The simulation runs on its own thread and publishes a snapshot of the
+ *   world after every tick through a lock-free triple buffer; the GLUT
+ *   thread only handles input and draws the newest complete snapshot, so
+ *   neither ever waits for the other.
+ *
+ *   command line options (after the usual GLUT ones):
+ *  -budget ms   frame time budget for the detail governor (default 16.6)
+ *  -capture file   record every displayed frame; 'file' ending in .ppm
+ *                  writes one image per frame (a printf pattern such as
+ *                  shot%05d.ppm is honoured), .y4m writes a YUV4MPEG2
+ *                  stream and anything else raw RGB24 frames
+ *  -behaviour mode  start with asteroids that drift, flock, separate or home
+ *  -threads n       threads used for asteroid behaviour (default 1)
+ *  -telemetry name  POSIX shared memory object for live statistics
+ *                  (default /asteroids.<pid>, 'off' disables it); read
+ *                  it with asteroids-stat
+ *
+ *   asteroids -bench [-capture file] [-threads n] scenario...
+ *   plays each scenario file headless and prints frame time percentiles
+ *   and peak RSS; see loadScenario() for the file format.  Built with
+ *   -DUSE_OSMESA the draw path renders into an offscreen OSMesa context,
+ *   otherwise only the simulation is timed.
+ *   asteroids -bench -pairs n  times the ship-asteroid test per pair.
  */
 
+#define GL_GLEXT_PROTOTYPES
+
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <math.h>
 #include <GL/glut.h>
+#ifdef FREEGLUT
+#include <GL/freeglut_ext.h>
+#endif
 #include <stdio.h>
 #include <GL/gl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <semaphore.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <malloc.h>
+#ifdef USE_OSMESA
+#include <GL/osmesa.h>
+#endif
+
+#include "telemetry.h"
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
@@ -40,8 +84,32 @@
 #define MAX_VERTICES 16
 #define CIRCLE_MULTIPLIER 2.0
 #define SHIP_POINTS 3
+#define SHIP_RADIUS 4.48 /* bounds shipP: (+-2, -4) lies sqrt(20) = 4.472 out */
 #define BLAST_POINTS 100
 #define MAX_STARS 100
+#define DEBRIS_POINTS 3
+#define FRAME_BUDGET_MS 16.6
+#define DETAIL_MIN 0.1
+#define RENDER_INTERVAL 16
+#define SNAPSHOT_FRESH 4
+#define MAX_SCRIPT_EVENTS 256
+#define SWEEP_STEP 4
+#define CAPTURE_QUEUE 8
+#define CAPTURE_RAW 0
+#define CAPTURE_PPM 1
+#define CAPTURE_Y4M 2
+#define BEHAVIOUR_DRIFT 0
+#define BEHAVIOUR_FLOCK 1
+#define BEHAVIOUR_SEPARATE 2
+#define BEHAVIOUR_HOME 3
+#define BEHAVIOURS 4
+#define BEHAVIOUR_NEXT BEHAVIOURS /* request: the one after the current */
+#define NEIGHBOUR_RADIUS 8.0
+#define SEPARATION_RADIUS 4.0
+#define NEIGHBOUR_LIMIT 7   /* neighbours that end the search */
+#define CELL_OCCUPANCY 2    /* asteroids per search cell, on average */
+#define ASTEROID_SPEED_MAX 0.8
+#define MAX_THREADS 64
 
 #define drawCircle() glCallList(circle)
 
@@ -84,10 +152,19 @@ typedef struct
 typedef struct
 {
     int active, nVertices;
-    double x, y, phi, dx, dy, dphi, viz;
-    Coords coords[MAX_VERTICES];
+    double x, y, phi, dx, dy, dphi, viz, radius;
+    Coords turn, spin; /* cos, sin of phi and of dphi */
+    Coords axis;       /* last axis separating it from the ship, or 0, 0 */
+    Coords *coords;    /* MAX_VERTICES outline points in its world's pool */
 } Asteroid;
 
+typedef struct
+{
+    int active, nVertices;
+    double x, y, phi, viz;
+    Coords *coords; /* its snapshot's copy of the outline */
+} Sprite;           /* what the renderer needs of an asteroid */
+
 typedef struct
 {
     Coords location;
@@ -95,6 +172,61 @@ typedef struct
     double intensity;
 } Star;
 
+typedef struct
+{
+    Ship ship;
+    Sprite *asteroids;
+    Coords *outlines;
+    Photon *photons;
+    Star *stars;
+    int asteroidType, shipDestroyed, killCount, thrust, behaviour;
+    double xMax, yMax, blastColour, simTime;
+    unsigned long tick, shapes;
+} World;
+
+typedef struct
+{
+    int frame, special, down;
+    unsigned char key;
+} ScriptEvent;
+
+typedef struct
+{
+    char name[64];
+    unsigned int seed;
+    int frames, width, height;
+    int asteroids, photons, stars; /* -1 follows the sweep */
+    int behaviour;
+    int sweepMin, sweepMax;
+    int nEvents;
+    ScriptEvent events[MAX_SCRIPT_EVENTS];
+} Scenario;
+
+typedef struct
+{
+    double x, y, dx, dy;
+} Boid;
+
+typedef struct
+{
+    double n, ax, ay, px, py, sx, sy; /* count; sums of velocity, offset and
+                                         separation push over neighbours */
+} Flock;
+
+typedef struct
+{
+    unsigned char *pixels; /* RGBA, bottom row first */
+    size_t capacity;
+    int w, h;
+} CaptureSlot;
+
+typedef struct
+{
+    Asteroid a;
+    Coords s[SHIP_POINTS];
+    Coords outline[MAX_VERTICES];
+} Pair;
+
 /* -- function prototypes --------------------------------------------------- */
 
 static void myDisplay(void);
@@ -103,6 +235,46 @@ static void myKey(unsigned char key, int x, int y);
 static void keyPress(int key, int x, int y);
 static void keyRelease(int key, int x, int y);
 static void myReshape(int w, int h);
+static void myRedisplay(int value);
+
+static void *simLoop(void *arg);
+static void stopSimulation(void);
+static void publishWorld(void);
+static World *acquireWorld(void);
+static void firePhoton(void);
+static int allocWorld(void);
+static void freeWorld(void);
+static void drawScene(void);
+
+static int runBenchmarks(int argc, char *argv[]);
+static int loadScenario(const char *path, Scenario *sc);
+static void runScenario(Scenario *sc, int count);
+static int resetPeakRss(void);
+static long peakRss(void);
+static int openOffscreen(int w, int h);
+
+static int startCapture(const char *path);
+static void stopCapture(void);
+static void captureFrame(int w, int h);
+static void flushCapture(void);
+static void *captureLoop(void *arg);
+static void writeCapture(CaptureSlot *slot);
+
+static int openTelemetry(const char *name);
+static void closeTelemetry(void);
+static void updateTelemetry(double start);
+
+static void placeShip(Coords out[SHIP_POINTS]);
+static void turnAsteroid(Asteroid *a);
+static int shipTouches(Asteroid *a, const Coords s[SHIP_POINTS], int circle);
+static int runPairBenchmark(int pairs);
+
+static int parseBehaviour(const char *name);
+static int startWorkers(int n);
+static void *steerWorker(void *arg);
+static int steerAsteroids(void);
+static void steerRange(int first, int last);
+static int buildCells(void);
 
 static void init(void);
 static void initAsteroid(Asteroid *a, double x, double y, double size);
@@ -110,32 +282,128 @@ static void drawCounter();
 static void drawStar(Star *s);
 static void drawShip(Ship *s);
 static void drawPhoton(Photon *p);
-static void drawAsteroid(Asteroid *a);
+static void drawAsteroid(Sprite *a);
 static void drawBitmapText(char *string, float x, float y);
 static void drawBitmapInt(int i, float x, float y);
+static void drawBitmapString(char *string, float x, float y);
+static void drawStats(void);
 
+static void updateGovernor(double ms);
 static double myRandom(double min, double max);
+static double myClock(void);
+static void sleepMs(double ms);
 
 /* -- global variables ------------------------------------------------------ */
 
-static int up = 0, down = 0, left = 0, right = 0; /* state of cursor keys */
-int photonCounter, fps, asteroidType, shipDestroyed, usePointPolyTest, killCount;
+/* input shared between the GLUT thread and the simulation thread */
+static atomic_int up, down, left, right; /* state of cursor keys */
+static atomic_int fps, fireRequests, restartRequest, typeRequest = -1;
+static atomic_int viewW, viewH;
+
+/* simulation state, owned by the simulation thread */
+int photonCounter, asteroidType, shipDestroyed, usePointPolyTest, killCount;
 static double width = 500.0, height = 300.0, accel, velMax;
 static double xMax, yMax;
-static Asteroid asteroids[MAX_ASTEROIDS];
-static Photon photons[MAX_PHOTONS];
-static Star stars[MAX_STARS];
+static int nAsteroids = MAX_ASTEROIDS, nPhotons = MAX_PHOTONS, nStars = MAX_STARS;
+static Asteroid *asteroids;
+static Coords *outlines; /* the asteroids' outlines, set in init() only */
+static Photon *photons;
+static Star *stars;
 static Ship ship;
-static Coords shipP[SHIP_POINTS];
+static const Coords shipP[SHIP_POINTS] = {{0, 4}, {-2, -4}, {2, -4}};
 double blastColour, flameX, flameY;
+static double simTime;
+static unsigned long tickCount, shapes; /* shapes counts calls to init() */
+static pthread_t simThread;
+static atomic_int simStop;
+
+/* triple buffer: the simulation fills snapshots[backSlot], the renderer
+   reads snapshots[frontSlot], and the two swap through middleSlot */
+static World snapshots[3];
+static int backSlot = 0, frontSlot = 1;
+static atomic_int middleSlot = 2;
+static World *scene; /* snapshot being drawn */
+static int headless;  /* no GLUT; bitmap text is skipped */
+
+/* frame capture: two PBOs on the GL thread feed a bounded single-producer
+   single-consumer queue drained by the writer thread */
+static const char *capturePath;
+static int captureFormat, captureW, captureH, pboW, pboH, pboIndex, pboPending;
+static GLuint capturePbo[2];
+static CaptureSlot captureSlots[CAPTURE_QUEUE];
+static atomic_ulong captureHead, captureTail, captureWritten, captureDropped;
+static atomic_int captureStop;
+static sem_t captureReady;
+static pthread_t captureWriter;
+static FILE *captureFile;
+static unsigned char *captureScratch;
+
+/* live statistics in shared memory, written by the simulation thread */
+static TelemetryStats *telemetry;
+static char telemetryName[256];
+static double lastTickStart, tickRate;
+static unsigned long collisionPairs, collisionHits;
+static atomic_uint frameTimeUs, detailPermille = 1000; /* from the renderer */
+
+/* asteroid behaviour: a cell list rebuilt every tick answers neighbour
+   queries; steering is split across the simulation thread and workers */
+static const char *behaviourNames[BEHAVIOURS] = {"drift", "flock", "separate", "home"};
+static int behaviour, nThreads = 1;
+static atomic_int behaviourRequest = -1;
+static int cellCols, cellRows, cellCapacity, itemCapacity;
+static double cellW, cellH;
+static int *cellStart, *cellFill, *cellItems, *asteroidCell;
+static float *cellX, *cellY, *cellDx, *cellDy; /* cellItems' motion, in cell
+                                                  order, for the search */
+static Boid *motion; /* the same gathered in index order, exact */
+static int nBoids;
+static double *steerDx, *steerDy;
+static pthread_t workers[MAX_THREADS];
+static pthread_barrier_t steerStart, steerDone;
+
+/* frame-budget governor: cosmetic detail in [DETAIL_MIN, 1] */
+static double frameBudget = FRAME_BUDGET_MS, frameTime, detail = 1.0;
+static int showStats, nStarsVisible = MAX_STARS, blastPoints = BLAST_POINTS;
+static int debrisPoints = DEBRIS_POINTS, vertexStride = 1;
 
 /* -- main ------------------------------------------------------------------ */
 
 int main(int argc, char *argv[])
 {
+    int i;
+    const char *telemetryArg = NULL;
+
+    if (argc > 1 && strcmp(argv[1], "-bench") == 0)
+        return runBenchmarks(argc - 2, argv + 2);
+
     srand((unsigned int)time(NULL));
 
     glutInit(&argc, argv);
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-budget") == 0 && i + 1 < argc)
+            frameBudget = atof(argv[++i]);
+        else if (strcmp(argv[i], "-capture") == 0 && i + 1 < argc)
+        {
+            if (!startCapture(argv[++i]))
+                return 1;
+        }
+        else if (strcmp(argv[i], "-telemetry") == 0 && i + 1 < argc)
+            telemetryArg = argv[++i];
+        else if (strcmp(argv[i], "-behaviour") == 0 && i + 1 < argc)
+        {
+            behaviour = parseBehaviour(argv[++i]);
+            if (behaviour < 0)
+                return 1;
+        }
+        else if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc)
+            nThreads = atoi(argv[++i]);
+    }
+    if (!startWorkers(nThreads))
+        return 1;
+    if (frameBudget <= 0)
+        frameBudget = FRAME_BUDGET_MS;
+
     glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB);
     glutInitWindowSize(width, height);
     glutCreateWindow("Asteroids");
@@ -146,11 +414,33 @@ int main(int argc, char *argv[])
     glutSpecialFunc(keyPress);
     glutSpecialUpFunc(keyRelease);
     glutReshapeFunc(myReshape);
-    glutTimerFunc(33, myTimer, 0);
+#ifdef FREEGLUT
+    /* closing the window exits without the 'q' key's flush */
+    glutCloseFunc(flushCapture);
+#endif
+    glutTimerFunc(RENDER_INTERVAL, myRedisplay, 0);
     glClearColor(0.0, 0.0, 0.0, 1.0);
     glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
+    if (!allocWorld())
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
     init();
+    publishWorld();
+    scene = acquireWorld();
+
+    if (!telemetryArg || strcmp(telemetryArg, "off") != 0)
+        openTelemetry(telemetryArg);
+
+    if (pthread_create(&simThread, NULL, simLoop, NULL) != 0)
+    {
+        fprintf(stderr, "could not start the simulation thread\n");
+        return 1;
+    }
+    /* registered after openTelemetry(), so it runs before closeTelemetry() */
+    atexit(stopSimulation);
 
     glutMainLoop();
 
@@ -165,30 +455,52 @@ void myDisplay()
      *	display callback function
      */
 
+    double start = myClock();
+
+    scene = acquireWorld();
+    drawScene();
+    if (showStats)
+        drawStats();
+
+    /* the simulation no longer shares this thread, so only the draw work
+       counts; capture and the swap are left out so that neither the copy
+       nor a vsync wait is mistaken for load */
+    updateGovernor(myClock() - start);
+    captureFrame(viewW, viewH);
+    glutSwapBuffers();
+}
+
+void drawScene()
+{
+    /*
+     *	draw the current scene; shared by the display callback and the
+     *	offscreen benchmark
+     */
+
     int i, j;
 
     glClear(GL_COLOR_BUFFER_BIT);
 
-    for (i = 0; i < MAX_STARS; i++)
+    for (i = 0; i < nStarsVisible; i++)
     {
-        drawStar(&stars[i]);
+        drawStar(&scene->stars[i]);
     }
 
-    drawShip(&ship);
+    drawShip(&scene->ship);
 
-    for (i = 0; i < MAX_PHOTONS; i++)
-        if (photons[i].active == 1)
+    for (i = 0; i < nPhotons; i++)
+        if (scene->photons[i].active == 1)
         {
-            drawPhoton(&photons[i]);
+            drawPhoton(&scene->photons[i]);
         }
 
-    for (j = 0; j < MAX_ASTEROIDS; j++)
+    for (j = 0; j < nAsteroids; j++)
     {
         //if (asteroids[j].active)
-        drawAsteroid(&asteroids[j]);
+        drawAsteroid(&scene->asteroids[j]);
     }
 
-    if ((killCount % 8) == 0 && killCount > 0)
+    if ((scene->killCount % 8) == 0 && scene->killCount > 0)
     {
         glColor3f(0.0, 1.0, 0.0);
         glLoadIdentity();
@@ -198,15 +510,57 @@ void myDisplay()
     }
 
     drawCounter();
-    glutSwapBuffers();
+}
+
+void myRedisplay(int value)
+{
+    /*
+     *	render timer; only redraw when the simulation has published a
+     *	snapshot we have not drawn yet
+     */
+
+    if (atomic_load_explicit(&middleSlot, memory_order_relaxed) & SNAPSHOT_FRESH)
+        glutPostRedisplay();
+
+    glutTimerFunc(RENDER_INTERVAL, myRedisplay, value);
 }
 
 void myTimer(int value)
 {
     /*
-     *	timer callback function
+     *	timer callback function; runs one simulation tick on the
+     *	simulation thread
      */
 
+    double start = myClock();
+    int request;
+
+    collisionPairs = 0;
+    collisionHits = 0;
+
+    /* apply input queued by the GLUT thread */
+    if (atomic_exchange(&restartRequest, 0))
+    {
+        request = killCount;
+        init();
+        killCount = request;
+    }
+    request = atomic_exchange(&typeRequest, -1);
+    if (request >= 0)
+        asteroidType = request;
+    request = atomic_exchange(&behaviourRequest, -1);
+    if (request == BEHAVIOUR_NEXT)
+        behaviour = (behaviour + 1) % BEHAVIOURS;
+    else if (request >= 0)
+        behaviour = request;
+    for (request = atomic_exchange(&fireRequests, 0); request > 0; request--)
+        firePhoton();
+    if (viewW > 0 && viewH > 0)
+    {
+        xMax = 100.0 * viewW / viewH;
+        yMax = 100.0;
+    }
+
     /* rotate the ship */
     if (left == 1)
         ship.phi = ship.phi + 0.1;
@@ -252,9 +606,9 @@ void myTimer(int value)
 
     /* advance photon laser shots, eliminating those that have gone past
       the window boundaries */
-    int i, j, k, m;
+    int i, j, k, steered;
 
-    for (i = 0; i < MAX_PHOTONS; i++)
+    for (i = 0; i < nPhotons; i++)
     {
         if (photons[i].active == 1)
         {
@@ -267,12 +621,23 @@ void myTimer(int value)
         }
     }
 
-    /* advance asteroids */
-    for (j = 0; j < MAX_ASTEROIDS; j++)
+    /* steer asteroids that flock, keep apart or home in on the ship */
+    steered = behaviour != BEHAVIOUR_DRIFT && steerAsteroids();
+
+    /* advance asteroids; the debris of destroyed ones fades out */
+    for (j = 0; j < nAsteroids; j++)
     {
         asteroids[j].phi = asteroids[j].phi + asteroids[j].dphi;
+        turnAsteroid(&asteroids[j]);
+        if (asteroids[j].active == 0 && asteroidType && asteroids[j].viz > 0)
+            asteroids[j].viz = asteroids[j].viz - 0.02;
         if (asteroids[j].active == 1)
         {
+            if (steered)
+            {
+                asteroids[j].dx = steerDx[j];
+                asteroids[j].dy = steerDy[j];
+            }
             if (asteroids[j].x > xMax)
                 asteroids[j].x = 1;
             else if (asteroids[j].x < 0)
@@ -288,196 +653,152 @@ void myTimer(int value)
                 asteroids[j].y = asteroids[j].y + asteroids[j].dy;
         }
     }
-    double x, y, x0, y0, x1, y1, x2, y2, dist, lambda;
+    double x, y, x1, y1, x2, y2;
+    Coords shipOutline[SHIP_POINTS];
     int counter;
     /* test for and handle collisions */
-    /* photons and asteroids */
-    /* point-polygon test */
-    if (asteroidType)
+    /* photons and asteroids; asteroids in the outer loop, so the large
+       asteroid array is walked once rather than once per photon, and a
+       photon spent on one asteroid cannot destroy another behind it */
+    for (j = 0; j < nAsteroids; j++)
     {
-        for (i = 0; i < MAX_PHOTONS; i++)
+        for (i = 0; i < nPhotons && asteroids[j].active == 1; i++)
         {
-            if (photons[i].active)
-            {
-                x = photons[i].x;
-                y = photons[i].y;
+            if (!photons[i].active)
+                continue;
+            x = photons[i].x;
+            y = photons[i].y;
 
-                for (j = 0; j < MAX_ASTEROIDS; j++)
+            if (asteroidType) /* point-polygon test */
+            {
+                if ((x - asteroids[j].x) * (x - asteroids[j].x) +
+                        (y - asteroids[j].y) * (y - asteroids[j].y) >
+                    asteroids[j].radius * asteroids[j].radius)
+                    continue;
+                collisionPairs++;
+
+                counter = 0;
+                for (k = 0; k < MAX_VERTICES; k++)
                 {
-                    counter = 0;
-                    if (asteroids[j].active)
-                    {
+                    x1 = asteroids[j].coords[k].x + asteroids[j].x;
+                    y1 = asteroids[j].coords[k].y + asteroids[j].y;
+                    x2 = asteroids[j].coords[(k + MAX_VERTICES + 1) % MAX_VERTICES].x + asteroids[j].x;
+                    y2 = asteroids[j].coords[(k + MAX_VERTICES + 1) % MAX_VERTICES].y + asteroids[j].y;
 
-                        for (k = 0; k < MAX_VERTICES; k++)
+                    if ((y1 < y && y < y2) || (y2 < y && y < y1))
+                    {
+                        if ((((y - y1) / (y2 - y1)) * x2 + ((y2 - y) / (y2 - y1)) * x1) > x)
                         {
-                            x1 = asteroids[j].coords[k].x + asteroids[j].x;
-                            y1 = asteroids[j].coords[k].y + asteroids[j].y;
-                            x2 = asteroids[j].coords[(k + MAX_VERTICES + 1) % MAX_VERTICES].x + asteroids[j].x;
-                            y2 = asteroids[j].coords[(k + MAX_VERTICES + 1) % MAX_VERTICES].y + asteroids[j].y;
-
-                            if ((y1 < y && y < y2) || (y2 < y && y < y1))
-                            {
-                                if ((((y - y1) / (y2 - y1)) * x2 + ((y2 - y) / (y2 - y1)) * x1) > x)
-                                {
-                                    counter++;
-                                }
-                            }
+                            counter++;
                         }
                     }
-                    if ((counter + 2) % 2 != 0)
-                    {
-                        asteroids[j].active = 0;
-                        photons[i].active = 0;
-                        killCount++;
-                        
-                        printf("killCount is: %0.d\n", killCount);
-                    }
                 }
+                if ((counter + 2) % 2 == 0)
+                    continue;
             }
-        }
-        for (i = 0; i < SHIP_POINTS; i++)
-        {
-            if (shipDestroyed != 1)
+            else /* point-circle test for photons inside of circle*/
             {
-                x = ship.x + shipP[(i + 4) % 3].x;
-                y = ship.y + shipP[(i + 4) % 3].y;
+                collisionPairs++;
+                if ((pow((x - asteroids[j].x), 2) + pow((y - asteroids[j].y), 2)) >
+                    pow(CIRCLE_MULTIPLIER, 2))
+                    continue;
+            }
 
-                for (j = 0; j < MAX_ASTEROIDS; j++)
-                {
-                    counter = 0;
-                    if (asteroids[j].active)
-                    {
+            asteroids[j].active = 0;
+            photons[i].active = 0;
+            killCount++;
+            collisionHits++;
+        }
+    }
 
-                        for (k = 0; k < MAX_VERTICES; k++)
-                        {
-                            x1 = asteroids[j].coords[k].x + asteroids[j].x;
-                            y1 = asteroids[j].coords[k].y + asteroids[j].y;
-                            x2 = asteroids[j].coords[(k + MAX_VERTICES + 1) % MAX_VERTICES].x + asteroids[j].x;
-                            y2 = asteroids[j].coords[(k + MAX_VERTICES + 1) % MAX_VERTICES].y + asteroids[j].y;
-
-                            if ((y1 < y && y < y2) || (y2 < y && y < y1))
-                            {
-                                if ((((y - y1) / (y2 - y1)) * x2 + ((y2 - y) / (y2 - y1)) * x1) > x)
-                                {
-                                    counter++;
-                                }
-                            }
-                        }
-                    }
-                    if ((counter + 2) % 2 != 0)
-                    {
-                        asteroids[j].active = 0;
-                        shipDestroyed = 1;
-                    }
-                }
-            }
-            else /* point-circle test for photons inside of circle*/
+    /* ship and asteroids */
+    /* exact polygon test of the ship triangle against the outline or circle */
+    if (shipDestroyed != 1)
+    {
+        placeShip(shipOutline);
+        for (j = 0; j < nAsteroids; j++)
+        {
+            if (asteroids[j].active == 1)
             {
-                for (i = 0; i < MAX_PHOTONS; i++)
-                {
-                    for (j = 0; j < MAX_ASTEROIDS; j++)
-                    {
-                        if (asteroids[j].active == 1 && photons[i].active == 1)
-                        {
-                            if ((pow((photons[i].x - asteroids[j].x), 2) +
-                                 pow((photons[i].y - asteroids[j].y), 2)) <=
-                                pow(CIRCLE_MULTIPLIER, 2))
-                            {
-                                asteroids[j].active = 0;
-                                photons[i].active = 0;
-                                killCount++;
-                                printf("killCount is: %0.d\n", killCount);
-                            }
-                        }
-                    }
-                }
-                /* ship and asteroids */
-                /* point circle test  for ship vertices and circle*/
-                for (i = 0; i < SHIP_POINTS; i++)
+                collisionPairs++;
+                if (shipTouches(&asteroids[j], shipOutline, !asteroidType))
                 {
-                    for (j = 0; j < MAX_ASTEROIDS; j++)
-                    {
-                        if (asteroids[j].active == 1)
-                        {
-                            if ((pow((ship.x + shipP[i].x - asteroids[j].x), 2) +
-                                 pow((ship.y + shipP[i].y - asteroids[j].y), 2)) <=
-                                pow(CIRCLE_MULTIPLIER, 2))
-                            {
-                                asteroids[j].active = 0;
-                                shipDestroyed = 1;
-                            }
-                        }
-                    }
+                    asteroids[j].active = 0;
+                    shipDestroyed = 1;
+                    collisionHits++;
                 }
-                /* line circle test for ship and circle */
-                for (k = 0; k < SHIP_POINTS; k++)
-                {
-                    x1 = ship.x + shipP[k].x;
-                    y1 = ship.y + shipP[k].y;
-                    x2 = ship.x + shipP[(k + 4) % 3].x;
-                    y2 = ship.y + shipP[(k + 4) % 3].y;
+            }
+        }
+    }
 
-                    for (m = 0; m < MAX_ASTEROIDS; m++)
-                    {
-                        if (asteroids[m].active == 1)
-                        {
-                            x0 = asteroids[m].x;
-                            y0 = asteroids[m].y;
+    /* the explosion fades and the score resets once the ship is gone */
+    if (shipDestroyed)
+    {
+        blastColour = blastColour - 0.01;
+        killCount = 0;
+    }
 
-                            lambda = ((x0 - x1) * (x2 - x1) + (y0 - y1) * (y2 - y1)) /
-                                     (pow(x2 - x1, 2) + pow(y2 - y1, 2));
+    simTime = myClock() - start;
+    updateTelemetry(start);
+    publishWorld();
+}
 
-                            dist = pow(x1 - x0 + lambda * (x2 - x1), 2) +
-                                   pow(y1 - y0 + lambda * (y2 - y1), 2);
+void *simLoop(void *arg)
+{
+    /*
+     *	simulation thread; ticks every fps milliseconds (30 ticks per second
+     *	by default) against an absolute schedule, never waiting on rendering
+     */
 
-                            if (dist <= pow(CIRCLE_MULTIPLIER, 2) &&
-                                lambda >= 0 && lambda <= 1)
-                            {
-                                asteroids[j].active = 0;
-                                shipDestroyed = 1;
-                            }
-                        }
-                    }
-                }
-            }
-        }
+    double next = myClock();
+
+    while (!simStop)
+    {
+        myTimer(0);
+
+        next = next + fps;
+        double now = myClock();
+        if (next > now)
+            sleepMs(next - now);
+        else
+            next = now; /* fell behind; do not try to catch up */
     }
 
-    glutPostRedisplay();
+    return arg;
+}
+
+void stopSimulation()
+{
+    /*
+     *	let the tick in flight finish and join the simulation thread, so
+     *	nothing it writes to (telemetry in particular) is torn down under it
+     */
 
-    glutTimerFunc(fps, myTimer, value); /* 30 frames per second */
+    simStop = 1;
+    pthread_join(simThread, NULL);
 }
 
 void myKey(unsigned char key, int x, int y)
 {
     /*
      *	keyboard callback function; add code here for firing the laser,
-     *	starting and/or pausing the game, etc.
+     *	starting and/or pausing the game, etc.; anything that touches the
+     *	world is queued for the simulation thread
      */
-    int temp;
 
     switch (key)
     {
     case 32:
-        if (photonCounter >= MAX_PHOTONS)
-        {
-            photonCounter = 0;
-        }
-        photons[photonCounter].active = 1;
-        photons[photonCounter].x = ship.x;
-        photons[photonCounter].y = ship.y;
-        photons[photonCounter].dx = -(velMax + 0.1) * sin(ship.phi);
-        photons[photonCounter].dy = (velMax + 0.1) * cos(ship.phi);
-        photonCounter++;
+        atomic_fetch_add(&fireRequests, 1);
         break;
 
     //'a' sets asteroid type to jagged
     case 97:
-        asteroidType = 1;
+        typeRequest = 1;
         break;
     //'c' sets asteroid type to circle
     case 99:
-        asteroidType = 0;
+        typeRequest = 0;
         break;
     //'p' slows down playback for testing
     case 112:
@@ -485,17 +806,24 @@ void myKey(unsigned char key, int x, int y)
         break;
     //'q' resumes play
     case 113:
+        flushCapture();
         exit(0);
         break;
     //'r' resumes play
     case 114:
         fps = 33;
         break;
+    //'f' toggles the frame statistics overlay
+    case 102:
+        showStats = !showStats;
+        break;
+    //'b' cycles asteroid behaviour
+    case 98:
+        behaviourRequest = BEHAVIOUR_NEXT;
+        break;
     //'s' start
     case 115:
-        temp = killCount;
-        init();
-        killCount = temp;
+        restartRequest = 1;
         break;
     default:
         printf("No command associated with that key.");
@@ -558,13 +886,13 @@ void myReshape(int w, int h)
      *  determined by the aspect ratio of the viewport
      */
 
-    xMax = 100.0 * w / h;
-    yMax = 100.0;
+    viewW = w;
+    viewH = h;
 
     glViewport(0, 0, w, h);
     glMatrixMode(GL_PROJECTION);
     glLoadIdentity();
-    glOrtho(0.0, xMax, 0.0, yMax, -1.0, 1.0);
+    glOrtho(0.0, 100.0 * w / h, 0.0, 100.0, -1.0, 1.0);
 
     glMatrixMode(GL_MODELVIEW);
 }
@@ -591,10 +919,11 @@ void init()
     shipDestroyed = 0;
     blastColour = 1;
     usePointPolyTest = 1;
+    shapes++;
     int i;
     double x, y, size;
     //starfield
-    for (i = 0; i < MAX_STARS; i++)
+    for (i = 0; i < nStars; i++)
     {
         stars[i].location.x = myRandom(0, xMax);
         stars[i].location.y = myRandom(0, yMax);
@@ -602,7 +931,7 @@ void init()
         stars[i].size = myRandom(1, 5);
     }
     //asteroids
-    for (i = 0; i < MAX_ASTEROIDS; i++)
+    for (i = 0; i < nAsteroids; i++)
     {
         x = myRandom(1, 100);
         y = myRandom(1, 100);
@@ -613,13 +942,25 @@ void init()
         else
             initAsteroid(&asteroids[i], x, 0, size);
     }
-    //ship
-    shipP[0].x = 0;
-    shipP[0].y = 4;
-    shipP[1].x = -2;
-    shipP[1].y = -4;
-    shipP[2].x = 2;
-    shipP[2].y = -4;
+}
+
+void firePhoton()
+{
+    /*
+     *	launch the next photon from the ship's nose direction, recycling the
+     *	oldest one when all are in flight
+     */
+
+    if (photonCounter >= nPhotons)
+    {
+        photonCounter = 0;
+    }
+    photons[photonCounter].active = 1;
+    photons[photonCounter].x = ship.x;
+    photons[photonCounter].y = ship.y;
+    photons[photonCounter].dx = -(velMax + 0.1) * sin(ship.phi);
+    photons[photonCounter].dy = (velMax + 0.1) * cos(ship.phi);
+    photonCounter++;
 }
 
 void initAsteroid(
@@ -642,6 +983,10 @@ void initAsteroid(
     a->dx = myRandom(-0.8, 0.8);
     a->dy = myRandom(-0.8, 0.8);
     a->dphi = myRandom(-0.1, 0.1);
+    a->turn.x = 1.0;
+    a->turn.y = 0.0;
+    a->spin.x = cos(a->dphi);
+    a->spin.y = sin(a->dphi);
     a->viz = 1.0;
 
     a->nVertices = 6 + rand() % (MAX_VERTICES - 6);
@@ -652,28 +997,78 @@ void initAsteroid(
         a->coords[i].x = -r * sin(theta);
         a->coords[i].y = r * cos(theta);
     }
+    /* the outline runs through all MAX_VERTICES coords; the unused ones
+       sit at the centre, so no stale vertices survive a restart */
+    for (; i < MAX_VERTICES; i++)
+    {
+        a->coords[i].x = 0;
+        a->coords[i].y = 0;
+    }
+    a->axis.x = 0;
+    a->axis.y = 0;
+
+    /* bounding circle for early outs; covers every vertex the outline uses */
+    a->radius = 0;
+    for (i = 0; i < MAX_VERTICES; i++)
+    {
+        r = sqrt(a->coords[i].x * a->coords[i].x + a->coords[i].y * a->coords[i].y);
+        if (r > a->radius)
+            a->radius = r;
+    }
 
     a->active = 1;
 }
 
 void drawCounter(in)
 {
+    if (headless)
+        return;
+
     glLoadIdentity();
     glColor3f(1.0, 0.0, 1.0);
-    drawBitmapText("SCORE.", 5, yMax-10);
+    drawBitmapText("SCORE.", 5, scene->yMax-10);
 
-    glRasterPos2f(27, yMax-10);
+    glRasterPos2f(27, scene->yMax-10);
     char  tempB; 
-    tempB = (char)((killCount%10 + 48));
+    tempB = (char)((scene->killCount%10 + 48));
     glutBitmapCharacter(GLUT_BITMAP_9_BY_15, tempB);
 
-    glRasterPos2f(23, yMax-10);
+    glRasterPos2f(23, scene->yMax-10);
     char  tempC; 
-    tempC = (char)((killCount/10)%10 + 48);
+    tempC = (char)((scene->killCount/10)%10 + 48);
     glutBitmapCharacter(GLUT_BITMAP_9_BY_15, tempC);
 
 }
 
+void drawStats()
+{
+    /*
+     *	frame statistics overlay; shows the governor's measurements and the
+     *	detail levels it currently allows
+     */
+    char line[80];
+
+    glLoadIdentity();
+    glColor3f(1.0, 1.0, 0.0);
+    snprintf(line, sizeof(line), "frame %5.2f ms  budget %5.2f ms  detail %3.0f%%",
+             frameTime, frameBudget, detail * 100.0);
+    drawBitmapString(line, 5, scene->yMax - 20);
+    snprintf(line, sizeof(line), "stars %d/%d  blast %d/%d  debris %d/%d  lod 1/%d",
+             nStarsVisible, nStars, blastPoints, BLAST_POINTS,
+             debrisPoints, DEBRIS_POINTS, vertexStride);
+    drawBitmapString(line, 5, scene->yMax - 26);
+    snprintf(line, sizeof(line), "tick %lu  sim %5.2f ms  %s on %d thread%s",
+             scene->tick, scene->simTime, behaviourNames[scene->behaviour],
+             nThreads, nThreads == 1 ? "" : "s");
+    drawBitmapString(line, 5, scene->yMax - 32);
+    if (capturePath)
+    {
+        snprintf(line, sizeof(line), "capture %lu written  %lu dropped",
+                 (unsigned long)captureWritten, (unsigned long)captureDropped);
+        drawBitmapString(line, 5, scene->yMax - 38);
+    }
+}
+
 void drawStar(Star *s)
 {
     glLoadIdentity();
@@ -689,7 +1084,7 @@ void drawShip(Ship *s)
     glLoadIdentity();
     myTranslate2D(s->x, s->y);
     myRotate2D(s->phi);
-    if (!shipDestroyed)
+    if (!scene->shipDestroyed)
     {
         glColor3f(1.0, 1.0, 1.0);
         glBegin(GL_TRIANGLES);
@@ -698,7 +1093,7 @@ void drawShip(Ship *s)
         glVertex2f(shipP[2].x, shipP[2].y);
         glEnd();
 
-        if (up)
+        if (scene->thrust)
         {
             glColor3f(myRandom(0.7, 1.0), myRandom(0.0, 0.5), 0.0);
             flameX = myRandom(-1, 1);
@@ -715,23 +1110,21 @@ void drawShip(Ship *s)
         double theta = 0;
         double r = 0;
 
-        blastColour = blastColour - 0.01;
-
         r = myRandom(1.0, 20.0);
-        for (int i = 0; i < BLAST_POINTS; i++)
+        for (int i = 0; i < blastPoints; i++)
         {
             theta = 2.0 * M_PI * i / 20;
             glPointSize(3);
             glBegin(GL_POINTS);
-            glColor3f(myRandom(0.7, 1.0) * blastColour, myRandom(0.0, 0.4) * blastColour, 0.0);
+            glColor3f(myRandom(0.7, 1.0) * scene->blastColour, myRandom(0.0, 0.4) * scene->blastColour, 0.0);
             glVertex2f(-r * sin(theta), r * cos(theta));
             glEnd();
-            glColor3f(myRandom(0.7, 1.0) * blastColour, myRandom(0.0, 0.4) * blastColour, 0.0);
+            glColor3f(myRandom(0.7, 1.0) * scene->blastColour, myRandom(0.0, 0.4) * scene->blastColour, 0.0);
             glPointSize(2);
             glBegin(GL_POINTS);
             glVertex2f(-r / 2 * sin(theta + myRandom(0, 4)), r / 2 * cos(theta + myRandom(0, 8)));
             glEnd();
-            glColor3f(myRandom(0.7, 1.0) * blastColour, myRandom(0.0, 0.4) * blastColour, myRandom(0.0, 0.6) * blastColour);
+            glColor3f(myRandom(0.7, 1.0) * scene->blastColour, myRandom(0.0, 0.4) * scene->blastColour, myRandom(0.0, 0.6) * scene->blastColour);
             glPointSize(myRandom(0, 5));
             glBegin(GL_POINTS);
             glVertex2f(-r / 5 * sin(theta + 10), r / 5 * cos(theta + 5));
@@ -742,7 +1135,6 @@ void drawShip(Ship *s)
         drawBitmapText("To Continue Press s.", 60, 55);
         glColor3f(1.0, 0.0, 0.0);
         drawBitmapText("To Quit Press q.", 65, 45);
-        killCount = 0;
     }
     glColor3f(1.0, 1.0, 1.0);
 }
@@ -753,7 +1145,7 @@ void drawPhoton(Photon *p)
     glPointSize(3);
     glColor3f(0.0, 1.0, 1.0);
     myTranslate2D(p->x, p->y);
-    if (!shipDestroyed)
+    if (!scene->shipDestroyed)
     {
         glBegin(GL_POINTS);
         glVertex2f(0, 0);
@@ -761,13 +1153,13 @@ void drawPhoton(Photon *p)
     }
 }
 
-void drawAsteroid(Asteroid *a)
+void drawAsteroid(Sprite *a)
 {
     glLoadIdentity();
     glColor3f(1.0, 1.0, 1.0);
     myTranslate2D(a->x, a->y);
     myRotate2D(a->phi);
-    if (!asteroidType)
+    if (!scene->asteroidType)
     {
         drawCircle();
     }
@@ -775,8 +1167,19 @@ void drawAsteroid(Asteroid *a)
     {
         if (a->active == 1)
         {
+            /* full detail draws the outline the collision tests use,
+               through all MAX_VERTICES coords; coarser levels step over
+               the real vertices only, keeping at least three */
+            int step = vertexStride, n = MAX_VERTICES;
+
+            if (step > 1)
+            {
+                n = a->nVertices;
+                if (n / step < 3)
+                    step = n / 3;
+            }
             glBegin(GL_LINE_LOOP);
-            for (int i = 0; i < MAX_VERTICES; i++)
+            for (int i = 0; i < n; i += step)
             {
                 glVertex2f(a->coords[i].x, a->coords[i].y);
             }
@@ -784,39 +1187,1885 @@ void drawAsteroid(Asteroid *a)
         }
         else
         {
-            if (a->viz > 0)
-                a->viz = a->viz - 0.02;
             glColor3f(a->viz, a->viz, a->viz);
             glPointSize(1);
             glBegin(GL_POINTS);
             glVertex2f(myRandom(0, 3) * sin(myRandom(0, 4)), myRandom(0, 3) * cos(myRandom(0, 8)));
-            glVertex2f(myRandom(0, 5) * sin(myRandom(0, 4)), myRandom(0, 5) * cos(myRandom(0, 8)));
-            glVertex2f(myRandom(0, 8) * sin(myRandom(0, 4)), myRandom(0, 8) * cos(myRandom(0, 8)));
+            if (debrisPoints > 1)
+                glVertex2f(myRandom(0, 5) * sin(myRandom(0, 4)), myRandom(0, 5) * cos(myRandom(0, 8)));
+            if (debrisPoints > 2)
+                glVertex2f(myRandom(0, 8) * sin(myRandom(0, 4)), myRandom(0, 8) * cos(myRandom(0, 8)));
             glEnd();
         }
     }
 }
 
-/* -- helper function ------------------------------------------------------- */
+/* -- triple-buffered world snapshots -------------------------------------- */
 
-double
-myRandom(double min, double max)
+void publishWorld()
 {
-    double d;
+    /*
+     *	copy the simulation state into the back snapshot and swap it into
+     *	the middle slot, marking it fresh; whatever the renderer left in
+     *	the middle becomes the new back snapshot
+     */
 
-    /* return a random number uniformly draw from [min,max] */
-    d = min + (max - min) * (rand() % 0x7fff) / 32767.0;
+    World *w = &snapshots[backSlot];
+    Sprite *s;
+    int j;
 
-    return d;
+    /* outlines only change in init(), so they are copied only when the
+       snapshot's are older; its sprites point into its own pool */
+    w->ship = ship;
+    if (w->shapes != shapes)
+    {
+        memcpy(w->outlines, outlines, (size_t)nAsteroids * MAX_VERTICES * sizeof(Coords));
+        w->shapes = shapes;
+    }
+    for (j = 0; j < nAsteroids; j++)
+    {
+        s = &w->asteroids[j];
+        s->active = asteroids[j].active;
+        s->nVertices = asteroids[j].nVertices;
+        s->x = asteroids[j].x;
+        s->y = asteroids[j].y;
+        s->phi = asteroids[j].phi;
+        s->viz = asteroids[j].viz;
+    }
+    memcpy(w->photons, photons, nPhotons * sizeof(Photon));
+    memcpy(w->stars, stars, nStars * sizeof(Star));
+    w->asteroidType = asteroidType;
+    w->shipDestroyed = shipDestroyed;
+    w->killCount = killCount;
+    w->thrust = up;
+    w->behaviour = behaviour;
+    w->xMax = xMax;
+    w->yMax = yMax;
+    w->blastColour = blastColour;
+    w->simTime = simTime;
+    w->tick = ++tickCount;
+
+    backSlot = atomic_exchange_explicit(&middleSlot, backSlot | SNAPSHOT_FRESH,
+                                        memory_order_acq_rel) & 3;
 }
 
-void drawBitmapText(char *string, float x, float y)
+int allocWorld()
 {
-    char *c;
-    glRasterPos2f(x, y);
+    /*
+     *	allocate the simulation arrays and the three snapshots for the
+     *	current entity counts; returns 0 when out of memory
+     */
 
-    for (c = string; *c != '.'; c++)
+    int i, j;
+
+    asteroids = calloc(nAsteroids, sizeof(Asteroid));
+    outlines = calloc((size_t)nAsteroids * MAX_VERTICES, sizeof(Coords));
+    photons = calloc(nPhotons, sizeof(Photon));
+    stars = calloc(nStars, sizeof(Star));
+    if (!asteroids || !outlines || !photons || !stars)
+        return 0;
+    for (j = 0; j < nAsteroids; j++)
+        asteroids[j].coords = outlines + (size_t)j * MAX_VERTICES;
+
+    for (i = 0; i < 3; i++)
     {
-        glutBitmapCharacter(GLUT_BITMAP_9_BY_15, *c);
+        snapshots[i].asteroids = calloc(nAsteroids, sizeof(Sprite));
+        snapshots[i].outlines = calloc((size_t)nAsteroids * MAX_VERTICES, sizeof(Coords));
+        snapshots[i].photons = calloc(nPhotons, sizeof(Photon));
+        snapshots[i].stars = calloc(nStars, sizeof(Star));
+        snapshots[i].shapes = 0;
+        if (!snapshots[i].asteroids || !snapshots[i].outlines || !snapshots[i].photons ||
+            !snapshots[i].stars)
+            return 0;
+        for (j = 0; j < nAsteroids; j++)
+            snapshots[i].asteroids[j].coords = snapshots[i].outlines + (size_t)j * MAX_VERTICES;
+    }
+
+    nStarsVisible = nStars;
+    return 1;
+}
+
+void freeWorld()
+{
+    int i;
+
+    free(asteroids);
+    free(outlines);
+    free(photons);
+    free(stars);
+    for (i = 0; i < 3; i++)
+    {
+        free(snapshots[i].asteroids);
+        free(snapshots[i].outlines);
+        free(snapshots[i].photons);
+        free(snapshots[i].stars);
+        memset(&snapshots[i], 0, sizeof(World));
+    }
+    asteroids = NULL;
+    outlines = NULL;
+    photons = NULL;
+    stars = NULL;
+
+    /* the cell list is sized for the world; the next buildCells() regrows it */
+    free(cellStart);
+    free(cellFill);
+    free(cellItems);
+    free(cellX);
+    free(cellY);
+    free(cellDx);
+    free(cellDy);
+    free(motion);
+    free(asteroidCell);
+    free(steerDx);
+    free(steerDy);
+    cellStart = cellFill = cellItems = asteroidCell = NULL;
+    cellX = cellY = cellDx = cellDy = NULL;
+    motion = NULL;
+    steerDx = steerDy = NULL;
+    cellCapacity = itemCapacity = 0;
+}
+
+World *acquireWorld()
+{
+    /*
+     *	return the newest complete snapshot; if the simulation has published
+     *	since the last call, trade our front snapshot for it
+     */
+
+    if (atomic_load_explicit(&middleSlot, memory_order_relaxed) & SNAPSHOT_FRESH)
+        frontSlot = atomic_exchange_explicit(&middleSlot, frontSlot,
+                                             memory_order_acq_rel) & 3;
+
+    return &snapshots[frontSlot];
+}
+
+/* -- scenario benchmark --------------------------------------------------- */
+
+int runBenchmarks(int argc, char *argv[])
+{
+    /*
+     *	play every scenario file named on the command line, once per entity
+     *	count of its sweep (count 0 means the scenario has no sweep)
+     */
+
+    Scenario sc;
+    int i, count;
+
+    while (argc > 1 && argv[0][0] == '-')
+    {
+        if (strcmp(argv[0], "-capture") == 0)
+        {
+            if (!startCapture(argv[1]))
+                return 1;
+        }
+        else if (strcmp(argv[0], "-threads") == 0)
+            nThreads = atoi(argv[1]);
+        else if (strcmp(argv[0], "-pairs") == 0)
+            return runPairBenchmark(atoi(argv[1]));
+        else
+            break;
+        argc = argc - 2;
+        argv = argv + 2;
+    }
+    if (argc < 1 || argv[0][0] == '-')
+    {
+        fprintf(stderr, "usage: asteroids -bench [-capture file] [-threads n] scenario...\n");
+        return 1;
+    }
+    if (!startWorkers(nThreads))
+        return 1;
+
+    headless = 1;
+    /* a fixed threshold keeps every large array on mmap; glibc otherwise
+       raises it as they are freed and keeps later ones in the heap, where
+       they stay resident into the next run's peak */
+    mallopt(M_MMAP_THRESHOLD, 128 * 1024);
+#ifndef USE_OSMESA
+    printf("# built without USE_OSMESA: timing the simulation only\n");
+#endif
+    printf("%-20s %8s %6s %8s %8s %8s %8s %8s %10s\n", "scenario", "count",
+           "frames", "p50 ms", "p90 ms", "p99 ms", "max ms", "sim p50", "peak KiB");
+
+    for (i = 0; i < argc; i++)
+    {
+        if (!loadScenario(argv[i], &sc))
+            return 1;
+
+        if (sc.sweepMin <= 0)
+        {
+            runScenario(&sc, 0);
+            continue;
+        }
+        for (count = sc.sweepMin;; count = count * SWEEP_STEP)
+        {
+            if (count > sc.sweepMax)
+                count = sc.sweepMax;
+            runScenario(&sc, count);
+            if (count == sc.sweepMax)
+                break;
+        }
+    }
+    flushCapture();
+
+    return 0;
+}
+
+int loadScenario(const char *path, Scenario *sc)
+{
+    /*
+     *	scenario files hold one directive per line, '#' starts a comment:
+     *
+     *	  name      label for the report
+     *	  seed      n           RNG seed
+     *	  frames    n           number of ticks to play
+     *	  size      w h         offscreen viewport in pixels
+     *	  asteroids n|sweep     entity counts; 'sweep' follows the sweep
+     *	  photons   n|sweep     (photons are kept in flight at all times)
+     *	  stars     n|sweep
+     *	  behaviour drift|flock|separate|home
+     *	  sweep     min max     counts go min, 4*min, ... up to max
+     *	  key       frame c     press character key c ('space' for ' '); only
+     *	                        keys that act on the world: space, a, c, b, s
+     *	  hold      frame k     hold arrow key k (left, right, up, down)
+     *	  release   frame k     release arrow key k
+     */
+
+    FILE *f;
+    char line[256], word[32], arg[32];
+    int frame, n, special;
+
+    memset(sc, 0, sizeof(Scenario));
+    snprintf(sc->name, sizeof(sc->name), "%s", path);
+    sc->seed = 1;
+    sc->frames = 300;
+    sc->width = (int)width;
+    sc->height = (int)height;
+    sc->asteroids = MAX_ASTEROIDS;
+    sc->photons = MAX_PHOTONS;
+    sc->stars = MAX_STARS;
+
+    f = fopen(path, "r");
+    if (!f)
+    {
+        fprintf(stderr, "%s: cannot open scenario\n", path);
+        return 0;
+    }
+
+    while (fgets(line, sizeof(line), f))
+    {
+        char *hash = strchr(line, '#');
+        if (hash)
+            *hash = '\0';
+        n = sscanf(line, "%31s %31s", word, arg);
+        if (n < 1)
+            continue;
+
+        if (strcmp(word, "name") == 0 && n == 2)
+            snprintf(sc->name, sizeof(sc->name), "%s", arg);
+        else if (strcmp(word, "seed") == 0 && n == 2)
+            sc->seed = (unsigned int)strtoul(arg, NULL, 10);
+        else if (strcmp(word, "frames") == 0 && n == 2)
+            sc->frames = atoi(arg);
+        else if (strcmp(word, "size") == 0)
+            sscanf(line, "%*s %d %d", &sc->width, &sc->height);
+        else if (strcmp(word, "sweep") == 0)
+            sscanf(line, "%*s %d %d", &sc->sweepMin, &sc->sweepMax);
+        else if (strcmp(word, "asteroids") == 0 && n == 2)
+            sc->asteroids = strcmp(arg, "sweep") == 0 ? -1 : atoi(arg);
+        else if (strcmp(word, "photons") == 0 && n == 2)
+            sc->photons = strcmp(arg, "sweep") == 0 ? -1 : atoi(arg);
+        else if (strcmp(word, "stars") == 0 && n == 2)
+            sc->stars = strcmp(arg, "sweep") == 0 ? -1 : atoi(arg);
+        else if (strcmp(word, "behaviour") == 0 && n == 2)
+        {
+            sc->behaviour = parseBehaviour(arg);
+            if (sc->behaviour < 0)
+            {
+                fclose(f);
+                return 0;
+            }
+        }
+        else if ((strcmp(word, "key") == 0 || strcmp(word, "hold") == 0 ||
+                  strcmp(word, "release") == 0) &&
+                 sscanf(line, "%*s %d %31s", &frame, arg) == 2 &&
+                 sc->nEvents < MAX_SCRIPT_EVENTS)
+        {
+            ScriptEvent *e = &sc->events[sc->nEvents];
+
+            special = word[0] != 'k';
+            e->frame = frame;
+            e->special = special;
+            e->down = word[0] != 'r';
+            if (!special)
+            {
+                /* q would exit mid-run, p, r and f change the window only */
+                e->key = strcmp(arg, "space") == 0 ? ' ' : (unsigned char)arg[0];
+                if (!strchr(" acbs", e->key) || (e->key != ' ' && arg[1]))
+                {
+                    fprintf(stderr, "%s: cannot script key '%s'\n", path, arg);
+                    continue;
+                }
+            }
+            else if (strcmp(arg, "left") == 0)
+                e->key = GLUT_KEY_LEFT;
+            else if (strcmp(arg, "up") == 0)
+                e->key = GLUT_KEY_UP;
+            else if (strcmp(arg, "right") == 0)
+                e->key = GLUT_KEY_RIGHT;
+            else if (strcmp(arg, "down") == 0)
+                e->key = GLUT_KEY_DOWN;
+            else
+            {
+                fprintf(stderr, "%s: unknown key '%s'\n", path, arg);
+                continue;
+            }
+            sc->nEvents++;
+        }
+        else
+            fprintf(stderr, "%s: ignoring '%s'\n", path, word);
+    }
+    fclose(f);
+
+    if (sc->sweepMax < sc->sweepMin)
+        sc->sweepMax = sc->sweepMin;
+    if (sc->sweepMin <= 0 && (sc->asteroids < 0 || sc->photons < 0 || sc->stars < 0))
+    {
+        fprintf(stderr, "%s: 'sweep' count without a sweep range\n", path);
+        return 0;
+    }
+    if (sc->frames <= 0 || sc->width <= 0 || sc->height <= 0)
+    {
+        fprintf(stderr, "%s: bad frames or size\n", path);
+        return 0;
+    }
+
+    return 1;
+}
+
+static int compareDoubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+void runScenario(Scenario *sc, int count)
+{
+    /*
+     *	play one scenario at the given sweep count: every frame is one
+     *	simulation tick plus, when an offscreen context exists, the full
+     *	draw path finished with glFinish(); input goes through the same
+     *	key handlers GLUT would call
+     */
+
+    double *frameMs, *simMs, start, p50, p90, p99;
+    int i, e, drawing;
+    long peak;
+
+    nAsteroids = sc->asteroids < 0 ? count : sc->asteroids;
+    nPhotons = sc->photons < 0 ? count : sc->photons;
+    nStars = sc->stars < 0 ? count : sc->stars;
+    if (nAsteroids < 1)
+        nAsteroids = 1;
+    if (nPhotons < 1)
+        nPhotons = 1;
+
+    resetPeakRss();
+    frameMs = malloc(sc->frames * sizeof(double));
+    simMs = malloc(sc->frames * sizeof(double));
+    if (!frameMs || !simMs || !allocWorld())
+    {
+        fprintf(stderr, "%s: out of memory at count %d\n", sc->name, count);
+        free(frameMs);
+        free(simMs);
+        freeWorld();
+        return;
+    }
+
+    srand(sc->seed);
+    drawing = openOffscreen(sc->width, sc->height);
+    viewW = sc->width;
+    viewH = sc->height;
+    if (drawing)
+        myReshape(sc->width, sc->height);
+    init();
+    atomic_store(&fireRequests, 0);
+    atomic_store(&restartRequest, 0);
+    atomic_store(&typeRequest, -1);
+    atomic_store(&behaviourRequest, -1);
+    behaviour = sc->behaviour;
+    up = down = left = right = 0;
+
+    for (i = 0; i < sc->frames; i++)
+    {
+        for (e = 0; e < sc->nEvents; e++)
+        {
+            ScriptEvent *ev = &sc->events[e];
+            if (ev->frame != i)
+                continue;
+            if (!ev->special)
+                myKey(ev->key, 0, 0);
+            else if (ev->down)
+                keyPress(ev->key, 0, 0);
+            else
+                keyRelease(ev->key, 0, 0);
+        }
+
+        /* keep the whole photon pool in flight */
+        for (e = 0; e < nPhotons; e++)
+            if (!photons[e].active)
+            {
+                photons[e].active = 1;
+                photons[e].x = myRandom(0, xMax);
+                photons[e].y = myRandom(0, yMax);
+                photons[e].dx = myRandom(-velMax, velMax);
+                photons[e].dy = myRandom(-velMax, velMax);
+            }
+
+        start = myClock();
+        myTimer(0);
+        simMs[i] = myClock() - start;
+        if (drawing)
+        {
+            scene = acquireWorld();
+            drawScene();
+            captureFrame(sc->width, sc->height);
+            glFinish();
+        }
+        frameMs[i] = myClock() - start;
+    }
+
+    qsort(frameMs, sc->frames, sizeof(double), compareDoubles);
+    qsort(simMs, sc->frames, sizeof(double), compareDoubles);
+    p50 = frameMs[(sc->frames - 1) * 50 / 100];
+    p90 = frameMs[(sc->frames - 1) * 90 / 100];
+    p99 = frameMs[(sc->frames - 1) * 99 / 100];
+    peak = peakRss();
+
+    printf("%-20s %8d %6d %8.3f %8.3f %8.3f %8.3f %8.3f %10ld\n", sc->name,
+           count, sc->frames, p50, p90, p99, frameMs[sc->frames - 1],
+           simMs[(sc->frames - 1) * 50 / 100], peak);
+    fflush(stdout);
+
+    free(frameMs);
+    free(simMs);
+    freeWorld();
+}
+
+int resetPeakRss()
+{
+    /*
+     *	drop the VmHWM high-water mark to the current RSS so the next
+     *	peakRss() covers a single run; needs Linux 4.0 or later.  The
+     *	previous run's world has been freed by now, and large arrays come
+     *	from mmap, so its pages are already gone from the RSS
+     */
+
+    static int warned;
+    FILE *f = fopen("/proc/self/clear_refs", "w");
+    int ok = f && fputs("5", f) >= 0;
+
+    if (f && fclose(f) != 0)
+        ok = 0;
+    if (!ok && !warned)
+    {
+        printf("# cannot reset VmHWM: peak KiB is the process high-water mark\n");
+        warned = 1;
+    }
+    return ok;
+}
+
+long peakRss()
+{
+    /*
+     *	VmHWM in KiB since the last resetPeakRss(), falling back to
+     *	ru_maxrss where /proc is not available
+     */
+
+    char line[128];
+    long kib = -1;
+    struct rusage usage;
+    FILE *f = fopen("/proc/self/status", "r");
+
+    if (f)
+    {
+        while (fgets(line, sizeof(line), f))
+            if (sscanf(line, "VmHWM: %ld", &kib) == 1)
+                break;
+        fclose(f);
+    }
+    if (kib < 0)
+    {
+        getrusage(RUSAGE_SELF, &usage);
+        kib = usage.ru_maxrss;
+    }
+    return kib;
+}
+
+int openOffscreen(int w, int h)
+{
+    /*
+     *	make an OSMesa (llvmpipe/softpipe) context current for the draw
+     *	path; returns 0 when built without OSMesa or when it fails.  The
+     *	context is reused across runs and replaced when the size changes
+     */
+
+#ifdef USE_OSMESA
+    static OSMesaContext ctx;
+    static GLubyte *buffer;
+    static int bufferW, bufferH;
+
+    if (ctx && w == bufferW && h == bufferH)
+        return 1;
+
+    if (!ctx)
+    {
+        ctx = OSMesaCreateContextExt(OSMESA_RGBA, 0, 0, 0, NULL);
+        if (!ctx)
+        {
+            fprintf(stderr, "OSMesaCreateContextExt failed\n");
+            return 0;
+        }
+    }
+    free(buffer);
+    buffer = malloc((size_t)w * h * 4);
+    if (!buffer || !OSMesaMakeCurrent(ctx, buffer, GL_UNSIGNED_BYTE, w, h))
+    {
+        fprintf(stderr, "OSMesaMakeCurrent failed\n");
+        return 0;
+    }
+    bufferW = w;
+    bufferH = h;
+
+    buildCircle();
+    glClearColor(0.0, 0.0, 0.0, 1.0);
+    glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+    return 1;
+#else
+    (void)w;
+    (void)h;
+    return 0;
+#endif
+}
+
+/* -- asynchronous frame capture ------------------------------------------- */
+
+static int framePattern(const char *path)
+{
+    /*
+     *	1 when path is safe to use as the printf format for frame file
+     *	names: exactly one int conversion such as %d or %05d, and no other
+     *	'%' except the literal %%
+     */
+
+    int conversions = 0;
+
+    for (; *path; path++)
+    {
+        if (*path != '%')
+            continue;
+        if (*++path == '%')
+            continue;
+        path += strspn(path, "0-+ ");
+        path += strspn(path, "0123456789");
+        if (*path != 'd' && *path != 'i')
+            return 0;
+        conversions++;
+    }
+
+    return conversions == 1;
+}
+
+int startCapture(const char *path)
+{
+    /*
+     *	pick the format from the file name, open the output and start the
+     *	writer thread; frames are written until the process exits
+     */
+
+    size_t n = strlen(path);
+
+    if (capturePath)
+        return 1;
+
+    if (n > 4 && strcmp(path + n - 4, ".ppm") == 0)
+    {
+        captureFormat = CAPTURE_PPM;
+        if (strchr(path, '%') && !framePattern(path))
+        {
+            fprintf(stderr, "%s: a capture pattern takes one %%d conversion "
+                            "(flags and width allowed) and %%%% for a literal %%\n", path);
+            return 0;
+        }
+    }
+    else if (n > 4 && strcmp(path + n - 4, ".y4m") == 0)
+        captureFormat = CAPTURE_Y4M;
+    else
+        captureFormat = CAPTURE_RAW;
+
+    if (captureFormat != CAPTURE_PPM)
+    {
+        captureFile = fopen(path, "wb");
+        if (!captureFile)
+        {
+            fprintf(stderr, "%s: cannot open capture file\n", path);
+            return 0;
+        }
+    }
+
+    sem_init(&captureReady, 0, 0);
+    if (pthread_create(&captureWriter, NULL, captureLoop, NULL) != 0)
+    {
+        fprintf(stderr, "could not start the capture thread\n");
+        return 0;
+    }
+    capturePath = path;
+    atexit(stopCapture);
+
+    return 1;
+}
+
+void stopCapture()
+{
+    /* let the writer drain the queue, then report */
+
+    if (!capturePath)
+        return;
+
+    captureStop = 1;
+    sem_post(&captureReady);
+    pthread_join(captureWriter, NULL);
+    if (captureFile)
+        fclose(captureFile);
+    fprintf(stderr, "capture: %lu frames written, %lu dropped\n",
+            (unsigned long)captureWritten, (unsigned long)captureDropped);
+    capturePath = NULL;
+}
+
+static void queuePbo(GLuint pbo, int wait)
+{
+    /*
+     *	map a PBO whose read back was started earlier and copy it into the
+     *	writer's queue.  When the queue is full the frame is dropped and
+     *	counted, unless wait is set, as it is for the last frame
+     */
+
+    unsigned long head, tail;
+    CaptureSlot *slot;
+    void *pixels;
+    size_t size = (size_t)pboW * pboH * 4;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+    pixels = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+    if (pixels)
+    {
+        head = atomic_load_explicit(&captureHead, memory_order_relaxed);
+        tail = atomic_load_explicit(&captureTail, memory_order_acquire);
+        while (wait && head - tail >= CAPTURE_QUEUE)
+        {
+            sleepMs(1.0);
+            tail = atomic_load_explicit(&captureTail, memory_order_acquire);
+        }
+        if (head - tail >= CAPTURE_QUEUE)
+            captureDropped++;
+        else
+        {
+            slot = &captureSlots[head % CAPTURE_QUEUE];
+            if (slot->capacity < size)
+            {
+                free(slot->pixels);
+                slot->pixels = malloc(size);
+                slot->capacity = slot->pixels ? size : 0;
+            }
+            if (slot->pixels)
+            {
+                memcpy(slot->pixels, pixels, size);
+                slot->w = pboW;
+                slot->h = pboH;
+                atomic_store_explicit(&captureHead, head + 1, memory_order_release);
+                sem_post(&captureReady);
+            }
+            else
+                captureDropped++;
+        }
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+void captureFrame(int w, int h)
+{
+    /*
+     *	start the read back of this frame into one PBO and hand the frame
+     *	read into the other PBO last time to the writer; the read back runs
+     *	asynchronously, so mapping the older PBO does not stall
+     */
+
+    int i;
+
+    if (!capturePath || w <= 0 || h <= 0)
+        return;
+
+    if (w != pboW || h != pboH)
+    {
+        if (pboW)
+        {
+            flushCapture();
+            glDeleteBuffers(2, capturePbo);
+        }
+        glGenBuffers(2, capturePbo);
+        for (i = 0; i < 2; i++)
+        {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, capturePbo[i]);
+            glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)w * h * 4, NULL, GL_STREAM_READ);
+        }
+        pboW = w;
+        pboH = h;
+        pboPending = 0;
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, capturePbo[pboIndex]);
+    glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    if (pboPending)
+        queuePbo(capturePbo[!pboIndex], 0);
+
+    pboPending = 1;
+    pboIndex = !pboIndex;
+}
+
+void flushCapture()
+{
+    /*
+     *	queue the frame still waiting in a PBO; called on the GL thread
+     *	before the context goes away, since stopCapture() runs at exit
+     */
+
+    if (!capturePath || !pboPending)
+        return;
+
+    queuePbo(capturePbo[!pboIndex], 1);
+    pboPending = 0;
+}
+
+void *captureLoop(void *arg)
+{
+    /*
+     *	writer thread; encodes and writes queued frames in order and exits
+     *	once asked to stop and the queue is empty
+     */
+
+    unsigned long head, tail;
+
+    for (;;)
+    {
+        sem_wait(&captureReady);
+        tail = atomic_load_explicit(&captureTail, memory_order_relaxed);
+        head = atomic_load_explicit(&captureHead, memory_order_acquire);
+        if (tail == head)
+        {
+            if (captureStop)
+                break;
+            continue;
+        }
+
+        writeCapture(&captureSlots[tail % CAPTURE_QUEUE]);
+        atomic_store_explicit(&captureTail, tail + 1, memory_order_release);
+    }
+
+    return arg;
+}
+
+void writeCapture(CaptureSlot *slot)
+{
+    /*
+     *	encode one frame, flipping it top row first: PPM files, raw RGB24 or
+     *	a YUV4MPEG2 4:4:4 frame (BT.601, studio range).  Streams keep the
+     *	size of their first frame; frames of any other size are dropped
+     */
+
+    unsigned char *src, *dst, *plane;
+    char name[1024];
+    FILE *f;
+    int x, y, r, g, b, n = slot->w * slot->h;
+
+    if (captureFormat != CAPTURE_PPM)
+    {
+        if (!captureW)
+        {
+            captureW = slot->w;
+            captureH = slot->h;
+            if (captureFormat == CAPTURE_Y4M)
+                fprintf(captureFile, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n",
+                        captureW, captureH, 1000 / (fps > 0 ? fps : 33));
+        }
+        if (slot->w != captureW || slot->h != captureH)
+        {
+            captureDropped++;
+            return;
+        }
+    }
+
+    dst = realloc(captureScratch, (size_t)n * 3);
+    if (!dst)
+    {
+        captureDropped++;
+        return;
+    }
+    captureScratch = dst;
+
+    if (captureFormat == CAPTURE_Y4M)
+    {
+        plane = captureScratch;
+        for (y = 0; y < slot->h; y++)
+        {
+            src = slot->pixels + (size_t)(slot->h - 1 - y) * slot->w * 4;
+            for (x = 0; x < slot->w; x++, src += 4, plane++)
+            {
+                r = src[0];
+                g = src[1];
+                b = src[2];
+                plane[0] = (unsigned char)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+                plane[n] = (unsigned char)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+                plane[2 * n] = (unsigned char)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+            }
+        }
+        fputs("FRAME\n", captureFile);
+        fwrite(captureScratch, 1, (size_t)n * 3, captureFile);
+    }
+    else
+    {
+        for (y = 0; y < slot->h; y++)
+        {
+            src = slot->pixels + (size_t)(slot->h - 1 - y) * slot->w * 4;
+            for (x = 0; x < slot->w; x++, src += 4, dst += 3)
+            {
+                dst[0] = src[0];
+                dst[1] = src[1];
+                dst[2] = src[2];
+            }
+        }
+
+        if (captureFormat == CAPTURE_RAW)
+            fwrite(captureScratch, 1, (size_t)n * 3, captureFile);
+        else
+        {
+            x = (int)strlen(capturePath);
+            if (strchr(capturePath, '%'))
+                snprintf(name, sizeof(name), capturePath, (int)captureWritten);
+            else
+                snprintf(name, sizeof(name), "%.*s%06lu.ppm", x - 4, capturePath,
+                         (unsigned long)captureWritten);
+            f = fopen(name, "wb");
+            if (!f)
+            {
+                captureDropped++;
+                return;
+            }
+            fprintf(f, "P6\n%d %d\n255\n", slot->w, slot->h);
+            fwrite(captureScratch, 1, (size_t)n * 3, f);
+            fclose(f);
+        }
+    }
+
+    captureWritten++;
+}
+
+/* -- shared-memory telemetry ---------------------------------------------- */
+
+int openTelemetry(const char *name)
+{
+    /*
+     *	create the shared memory block that asteroids-stat attaches to;
+     *	failure is not fatal, the game just runs without telemetry
+     */
+
+    int fd;
+    void *p;
+
+    if (name)
+        snprintf(telemetryName, sizeof(telemetryName), "%s%s",
+                 name[0] == '/' ? "" : "/", name);
+    else
+        snprintf(telemetryName, sizeof(telemetryName), TELEMETRY_NAME, (int)getpid());
+
+    fd = shm_open(telemetryName, O_CREAT | O_RDWR, 0644);
+    if (fd < 0 || ftruncate(fd, sizeof(TelemetryStats)) != 0)
+    {
+        perror(telemetryName);
+        if (fd >= 0)
+            close(fd);
+        return 0;
+    }
+    p = mmap(NULL, sizeof(TelemetryStats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+    {
+        perror("mmap");
+        shm_unlink(telemetryName);
+        return 0;
+    }
+
+    telemetry = p;
+    memset(telemetry, 0, sizeof(TelemetryStats));
+    telemetry->version = TELEMETRY_VERSION;
+    telemetry->size = sizeof(TelemetryStats);
+    telemetry->pid = (uint32_t)getpid();
+    telemetry->captureQueueSize = CAPTURE_QUEUE;
+    atomic_thread_fence(memory_order_release);
+    telemetry->magic = TELEMETRY_MAGIC;
+    atexit(closeTelemetry);
+
+    return 1;
+}
+
+void closeTelemetry()
+{
+    if (!telemetry)
+        return;
+
+    munmap(telemetry, sizeof(TelemetryStats));
+    shm_unlink(telemetryName);
+    telemetry = NULL;
+}
+
+void updateTelemetry(double start)
+{
+    /*
+     *	publish this tick's statistics under the sequence lock; called once
+     *	per tick by the simulation thread, the only writer
+     */
+
+    unsigned int seq, activeAsteroids = 0, activePhotons = 0;
+    unsigned long head, tail;
+    int i;
+
+    if (lastTickStart > 0 && start > lastTickStart)
+        tickRate = tickRate > 0 ? tickRate * 0.9 + 1000.0 / (start - lastTickStart) * 0.1
+                                : 1000.0 / (start - lastTickStart);
+    lastTickStart = start;
+
+    if (!telemetry)
+        return;
+
+    for (i = 0; i < nAsteroids; i++)
+        activeAsteroids += asteroids[i].active == 1;
+    for (i = 0; i < nPhotons; i++)
+        activePhotons += photons[i].active == 1;
+    head = atomic_load_explicit(&captureHead, memory_order_relaxed);
+    tail = atomic_load_explicit(&captureTail, memory_order_relaxed);
+
+    seq = atomic_load_explicit(&telemetry->seq, memory_order_relaxed);
+    atomic_store_explicit(&telemetry->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    telemetry->tick = tickCount + 1;
+    telemetry->tickRate = tickRate;
+    telemetry->tickTime = simTime;
+    telemetry->frameTime = frameTimeUs / 1000.0;
+    telemetry->detail = detailPermille / 1000.0;
+    telemetry->asteroids = nAsteroids;
+    telemetry->asteroidsActive = activeAsteroids;
+    telemetry->photons = nPhotons;
+    telemetry->photonsActive = activePhotons;
+    telemetry->stars = nStars;
+    telemetry->killCount = killCount;
+    telemetry->shipDestroyed = shipDestroyed;
+    telemetry->collisionPairs = collisionPairs;
+    telemetry->collisionHits = collisionHits;
+    telemetry->captureQueued = (uint32_t)(head - tail);
+    telemetry->captureWritten = captureWritten;
+    telemetry->captureDropped = captureDropped;
+
+    atomic_store_explicit(&telemetry->seq, seq + 2, memory_order_release);
+}
+
+/* -- ship collision --------------------------------------------------------- */
+
+void placeShip(Coords out[SHIP_POINTS])
+{
+    /* the ship triangle as drawn: rotated by phi about its position */
+
+    double c = cos(ship.phi), s = sin(ship.phi);
+    int i;
+
+    for (i = 0; i < SHIP_POINTS; i++)
+    {
+        out[i].x = ship.x + c * shipP[i].x - s * shipP[i].y;
+        out[i].y = ship.y + s * shipP[i].x + c * shipP[i].y;
+    }
+}
+
+void turnAsteroid(Asteroid *a)
+{
+    /*
+     *	advance the cached cos, sin of phi by one dphi step, so collision
+     *	tests need no trigonometry; renormalising keeps rounding from
+     *	drifting away from the angle drawn
+     */
+
+    double c = a->turn.x * a->spin.x - a->turn.y * a->spin.y;
+    double s = a->turn.y * a->spin.x + a->turn.x * a->spin.y;
+    double k = 1.5 - 0.5 * (c * c + s * s);
+
+    a->turn.x = c * k;
+    a->turn.y = s * k;
+}
+
+static void project(const Coords *p, int n, Coords axis, double *min, double *max)
+{
+    double d;
+    int i;
+
+    *min = *max = p[0].x * axis.x + p[0].y * axis.y;
+    for (i = 1; i < n; i++)
+    {
+        d = p[i].x * axis.x + p[i].y * axis.y;
+        *min = d < *min ? d : *min;
+        *max = d > *max ? d : *max;
+    }
+}
+
+static int separatesDisc(Coords axis, const Coords s[SHIP_POINTS], const Asteroid *a,
+                         double r)
+{
+    /* do the ship and a disc of radius r about the asteroid project onto
+       disjoint intervals of the unit axis? */
+
+    double smin, smax, centre = a->x * axis.x + a->y * axis.y;
+
+    project(s, SHIP_POINTS, axis, &smin, &smax);
+
+    return smax < centre - r || centre + r < smin;
+}
+
+static int separates(Coords axis, const Coords s[SHIP_POINTS], const Asteroid *a,
+                     double c, double sn, int circle)
+{
+    /*
+     *	do the ship and the asteroid project onto disjoint intervals of the
+     *	unit axis?  The outline is projected in the asteroid's own frame by
+     *	rotating the axis instead of every vertex
+     */
+
+    double smin, smax, amin, amax, centre, d;
+    Coords local;
+    int k;
+
+    if (circle)
+        return separatesDisc(axis, s, a, CIRCLE_MULTIPLIER);
+
+    project(s, SHIP_POINTS, axis, &smin, &smax);
+    centre = a->x * axis.x + a->y * axis.y;
+    local.x = c * axis.x + sn * axis.y;
+    local.y = -sn * axis.x + c * axis.y;
+    amin = amax = 0; /* the outline passes through the centre */
+    for (k = 0; k < MAX_VERTICES; k++)
+    {
+        d = a->coords[k].x * local.x + a->coords[k].y * local.y;
+        amin = d < amin ? d : amin; /* min/max instructions, no branches */
+        amax = d > amax ? d : amax;
+    }
+
+    return smax < amin + centre || amax + centre < smin;
+}
+
+static Coords edgeNormal(Coords p, Coords q)
+{
+    /* unit normal of edge pq, or 0, 0 for a degenerate edge */
+
+    Coords n;
+    double len;
+
+    n.x = p.y - q.y;
+    n.y = q.x - p.x;
+    len = sqrt(n.x * n.x + n.y * n.y);
+    if (len > 1e-12)
+    {
+        n.x = n.x / len;
+        n.y = n.y / len;
+    }
+    else
+        n.x = n.y = 0;
+
+    return n;
+}
+
+static int trianglesOverlap(const Coords *p, const Coords *q)
+{
+    /* separating axis test for two triangles; touching counts as overlap */
+
+    double pmin, pmax, qmin, qmax;
+    Coords axis;
+    int i;
+
+    for (i = 0; i < 6; i++)
+    {
+        if (i < 3)
+            axis = edgeNormal(p[i], p[(i + 1) % 3]);
+        else
+            axis = edgeNormal(q[i - 3], q[(i - 2) % 3]);
+        if (axis.x == 0 && axis.y == 0)
+            continue;
+        project(p, 3, axis, &pmin, &pmax);
+        project(q, 3, axis, &qmin, &qmax);
+        if (pmax < qmin || qmax < pmin)
+            return 0;
+    }
+
+    return 1;
+}
+
+int shipTouches(Asteroid *a, const Coords s[SHIP_POINTS], int circle)
+{
+    /*
+     *	exact test of the ship triangle against an asteroid's outline (as
+     *	drawn, rotated by phi) or its circle.  Most pairs never come close
+     *	and fail the bounding circles; of the rest most are still apart
+     *	along the axis that separated them last tick, which costs a single
+     *	projection (the asteroid's rotation is kept up to date by
+     *	turnAsteroid(), not recomputed).  Otherwise the ship's edge normals, the outline's edge
+     *	normals (or, for a circle, the axis to the nearest ship vertex) are
+     *	tried and the first separating one is cached.  Separating axes are
+     *	only conclusive for convex shapes, so when none is found for the
+     *	outline it is split into the fan of triangles around its centre
+     *	(the outline is star-shaped about it) and each is tested exactly
+     */
+
+    double dx = a->x - ship.x, dy = a->y - ship.y, reach, c, sn, d, best;
+    Coords p[MAX_VERTICES], tri[3], axis;
+    int i, k;
+
+    reach = SHIP_RADIUS + (circle ? CIRCLE_MULTIPLIER : a->radius);
+    if (dx * dx + dy * dy > reach * reach)
+        return 0;
+
+    c = a->turn.x;
+    sn = a->turn.y;
+    if ((a->axis.x != 0 || a->axis.y != 0) && separates(a->axis, s, a, c, sn, circle))
+        return 0;
+
+    for (i = 0; i < SHIP_POINTS; i++)
+    {
+        axis = edgeNormal(s[i], s[(i + 1) % SHIP_POINTS]);
+        if (separates(axis, s, a, c, sn, circle))
+        {
+            a->axis = axis;
+            return 0;
+        }
+    }
+
+    if (circle)
+    {
+        /* with the edge normals, the axis from the centre to the closest
+           vertex completes the test for a triangle and a circle */
+        best = -1;
+        for (i = 0; i < SHIP_POINTS; i++)
+        {
+            d = (s[i].x - a->x) * (s[i].x - a->x) + (s[i].y - a->y) * (s[i].y - a->y);
+            if (best < 0 || d < best)
+            {
+                best = d;
+                tri[0].x = a->x;
+                tri[0].y = a->y;
+                tri[1] = s[i];
+            }
+        }
+        axis = edgeNormal(tri[0], tri[1]);
+        d = axis.x;
+        axis.x = -axis.y;
+        axis.y = d;
+        if ((axis.x != 0 || axis.y != 0) && separates(axis, s, a, c, sn, circle))
+        {
+            a->axis = axis;
+            return 0;
+        }
+        a->axis.x = a->axis.y = 0;
+        return 1;
+    }
+
+    for (k = 0; k < MAX_VERTICES; k++)
+    {
+        p[k].x = a->x + c * a->coords[k].x - sn * a->coords[k].y;
+        p[k].y = a->y + sn * a->coords[k].x + c * a->coords[k].y;
+    }
+    for (k = 0; k < MAX_VERTICES; k++)
+    {
+        axis = edgeNormal(p[k], p[(k + 1) % MAX_VERTICES]);
+        if ((axis.x != 0 || axis.y != 0) && separates(axis, s, a, c, sn, circle))
+        {
+            a->axis = axis;
+            return 0;
+        }
+    }
+
+    a->axis.x = a->axis.y = 0;
+    tri[0].x = a->x;
+    tri[0].y = a->y;
+    for (k = 0; k < MAX_VERTICES; k++)
+    {
+        tri[1] = p[k];
+        tri[2] = p[(k + 1) % MAX_VERTICES];
+        if (fabs((tri[1].x - tri[0].x) * (tri[2].y - tri[0].y) -
+                 (tri[1].y - tri[0].y) * (tri[2].x - tri[0].x)) < 1e-12)
+            continue;
+        if (trianglesOverlap(s, tri))
+            return 1;
+    }
+
+    return 0;
+}
+
+int runPairBenchmark(int pairs)
+{
+    /*
+     *	time shipTouches() per pair for asteroids scattered around a ship
+     *	at random headings, by how the test ends: outside the bounding
+     *	circles, close but apart without and with a cached axis, apart only
+     *	in a concave notch (no single axis separates them, so nothing can
+     *	be cached), and touching; for both jagged and circle asteroids
+     */
+
+    static const char *kinds[5] = {"far (bounding)", "near, cold", "near, cached",
+                                   "near, concave", "touching"};
+    Pair *set[5], pair;
+    int count[5], circle, kind, i, j, rounds, tries, hits = 0;
+    double start, ns, dx, dy, reach;
+
+    if (pairs < 1)
+    {
+        fprintf(stderr, "usage: asteroids -bench -pairs n\n");
+        return 1;
+    }
+    for (kind = 0; kind < 5; kind++)
+    {
+        set[kind] = malloc(pairs * sizeof(Pair));
+        if (!set[kind])
+        {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+    }
+
+    srand(32);
+    ship.x = 50;
+    ship.y = 50;
+    printf("%-16s %-7s %8s %10s\n", "pair", "mode", "pairs", "ns/pair");
+
+    for (circle = 0; circle < 2; circle++)
+    {
+        for (kind = 0; kind < 5; kind++)
+            count[kind] = 0;
+        for (tries = 0; tries < 1000 * pairs; tries++)
+        {
+            ship.phi = myRandom(0, 2 * M_PI);
+            placeShip(pair.s);
+            pair.a.coords = pair.outline;
+            initAsteroid(&pair.a, ship.x + myRandom(-20, 20), ship.y + myRandom(-20, 20),
+                         myRandom(1, 3));
+            pair.a.phi = myRandom(0, 2 * M_PI);
+            pair.a.turn.x = cos(pair.a.phi);
+            pair.a.turn.y = sin(pair.a.phi);
+
+            dx = pair.a.x - ship.x;
+            dy = pair.a.y - ship.y;
+            reach = SHIP_RADIUS + (circle ? CIRCLE_MULTIPLIER : pair.a.radius);
+            if (dx * dx + dy * dy > reach * reach)
+                kind = 0;
+            else if (shipTouches(&pair.a, pair.s, circle))
+                kind = 4;
+            else
+                kind = pair.a.axis.x != 0 || pair.a.axis.y != 0 ? 1 : 3;
+            if (count[kind] < pairs)
+            {
+                set[kind][count[kind]] = pair;
+                set[kind][count[kind]].a.coords = set[kind][count[kind]].outline;
+                count[kind]++;
+            }
+            if (count[0] == pairs && count[1] == pairs && count[4] == pairs &&
+                (circle || count[3] == pairs))
+                break;
+        }
+        /* the cold runs clear the axes the sorting pass cached */
+        memcpy(set[2], set[1], count[1] * sizeof(Pair));
+        count[2] = count[1];
+        for (i = 0; i < count[2]; i++)
+            set[2][i].a.coords = set[2][i].outline;
+
+        for (kind = 0; kind < 5; kind++)
+        {
+            if (!count[kind])
+                continue;
+            rounds = 1 + 1000000 / count[kind];
+            start = myClock();
+            for (j = 0; j < rounds; j++)
+                for (i = 0; i < count[kind]; i++)
+                {
+                    if (kind == 1)
+                        set[kind][i].a.axis.x = set[kind][i].a.axis.y = 0;
+                    hits = hits + shipTouches(&set[kind][i].a, set[kind][i].s, circle);
+                }
+            ns = (myClock() - start) * 1.0e6 / ((double)rounds * count[kind]);
+            printf("%-16s %-7s %8d %10.1f\n", kinds[kind], circle ? "circle" : "jagged",
+                   count[kind], ns);
+        }
+    }
+
+    for (kind = 0; kind < 5; kind++)
+        free(set[kind]);
+
+    return hits < 0;
+}
+
+/* -- asteroid behaviour --------------------------------------------------- */
+
+int parseBehaviour(const char *name)
+{
+    int i;
+
+    for (i = 0; i < BEHAVIOURS; i++)
+        if (strcmp(name, behaviourNames[i]) == 0)
+            return i;
+
+    fprintf(stderr, "unknown behaviour '%s'\n", name);
+    return -1;
+}
+
+int startWorkers(int n)
+{
+    /*
+     *	start n - 1 steering workers; the simulation thread is the n-th.
+     *	They sleep on a barrier between ticks
+     */
+
+    long i;
+
+    if (n < 1 || n > MAX_THREADS)
+    {
+        fprintf(stderr, "threads must be between 1 and %d\n", MAX_THREADS);
+        return 0;
+    }
+    nThreads = n;
+    if (n == 1)
+        return 1;
+
+    pthread_barrier_init(&steerStart, NULL, n);
+    pthread_barrier_init(&steerDone, NULL, n);
+    for (i = 1; i < n; i++)
+        if (pthread_create(&workers[i], NULL, steerWorker, (void *)i) != 0)
+        {
+            fprintf(stderr, "could not start worker thread\n");
+            return 0;
+        }
+
+    return 1;
+}
+
+static int cellAt(int item)
+{
+    /* first cell whose asteroids start at or after cellItems[item] */
+
+    int lo = 0, hi = cellCols * cellRows, mid;
+
+    while (lo < hi)
+    {
+        mid = (lo + hi) / 2;
+        if (cellStart[mid] < item)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+void *steerWorker(void *arg)
+{
+    long id = (long)arg;
+
+    for (;;)
+    {
+        pthread_barrier_wait(&steerStart);
+        steerRange(cellAt((int)((long)nBoids * id / nThreads)),
+                   cellAt((int)((long)nBoids * (id + 1) / nThreads)));
+        pthread_barrier_wait(&steerDone);
+    }
+
+    return NULL;
+}
+
+int steerAsteroids()
+{
+    /*
+     *	rebuild the cell list and compute every asteroid's new velocity
+     *	from the unchanged world (in parallel) into steerDx, steerDy; the
+     *	caller applies them as it advances the asteroids.  Threads take
+     *	runs of whole cells holding about equal numbers of asteroids.
+     *	Returns 0 when out of memory
+     */
+
+    if (!buildCells())
+        return 0;
+    nBoids = cellStart[cellCols * cellRows];
+
+    if (nThreads > 1)
+    {
+        pthread_barrier_wait(&steerStart);
+        steerRange(0, cellAt(nBoids / nThreads));
+        pthread_barrier_wait(&steerDone);
+    }
+    else
+        steerRange(0, cellCols * cellRows);
+
+    return 1;
+}
+
+int buildCells()
+{
+    /*
+     *	bin active asteroids into a grid with a counting sort;
+     *	cellItems[cellStart[c] .. cellStart[c+1]) are the asteroids in cell
+     *	c, and cellX .. cellDy hold their positions and velocities in the
+     *	same order so neighbour searches stay in cache.  The asteroids
+     *	themselves are read once, the scatter works from motion.  Cells are
+     *	sized to hold about CELL_OCCUPANCY asteroids, never wider than
+     *	NEIGHBOUR_RADIUS.  Returns 0 when out of memory
+     */
+
+    int j, c, cx, cy, cells, span;
+    double side;
+
+    side = sqrt(CELL_OCCUPANCY * xMax * yMax / nAsteroids);
+    if (side > NEIGHBOUR_RADIUS)
+        side = NEIGHBOUR_RADIUS;
+    cellCols = (int)(xMax / side);
+    cellRows = (int)(yMax / side);
+    if (cellCols < 1)
+        cellCols = 1;
+    if (cellRows < 1)
+        cellRows = 1;
+    /* a search reaches span cells either side; with fewer cells across it
+       would meet the same cell twice, so such a field is one column or row
+       that does not wrap */
+    side = xMax / cellCols < yMax / cellRows ? xMax / cellCols : yMax / cellRows;
+    span = (int)ceil(NEIGHBOUR_RADIUS / side);
+    if (cellCols < 2 * span + 1)
+        cellCols = 1;
+    if (cellRows < 2 * span + 1)
+        cellRows = 1;
+    cellW = xMax / cellCols;
+    cellH = yMax / cellRows;
+    cells = cellCols * cellRows;
+
+    if (cells > cellCapacity)
+    {
+        free(cellStart);
+        free(cellFill);
+        cellStart = malloc((cells + 1) * sizeof(int));
+        cellFill = malloc(cells * sizeof(int));
+        cellCapacity = cellStart && cellFill ? cells : 0;
+        if (!cellCapacity)
+            return 0;
+    }
+    if (nAsteroids > itemCapacity)
+    {
+        free(cellItems);
+        free(cellX);
+        free(cellY);
+        free(cellDx);
+        free(cellDy);
+        free(motion);
+        free(asteroidCell);
+        free(steerDx);
+        free(steerDy);
+        cellItems = malloc(nAsteroids * sizeof(int));
+        cellX = malloc(nAsteroids * sizeof(float));
+        cellY = malloc(nAsteroids * sizeof(float));
+        cellDx = malloc(nAsteroids * sizeof(float));
+        cellDy = malloc(nAsteroids * sizeof(float));
+        motion = malloc(nAsteroids * sizeof(Boid));
+        asteroidCell = malloc(nAsteroids * sizeof(int));
+        steerDx = malloc(nAsteroids * sizeof(double));
+        steerDy = malloc(nAsteroids * sizeof(double));
+        itemCapacity = cellItems && cellX && cellY && cellDx && cellDy && motion &&
+                               asteroidCell && steerDx && steerDy
+                           ? nAsteroids
+                           : 0;
+        if (!itemCapacity)
+            return 0;
+    }
+
+    memset(cellStart, 0, (cells + 1) * sizeof(int));
+    for (j = 0; j < nAsteroids; j++)
+    {
+        if (asteroids[j].active != 1)
+        {
+            asteroidCell[j] = -1;
+            continue;
+        }
+        /* positions can sit just outside the field before they wrap */
+        cx = (int)(asteroids[j].x / cellW);
+        cy = (int)(asteroids[j].y / cellH);
+        cx = cx < 0 ? 0 : cx >= cellCols ? cellCols - 1 : cx;
+        cy = cy < 0 ? 0 : cy >= cellRows ? cellRows - 1 : cy;
+        c = cy * cellCols + cx;
+        asteroidCell[j] = c;
+        cellStart[c + 1]++;
+        motion[j].x = asteroids[j].x;
+        motion[j].y = asteroids[j].y;
+        motion[j].dx = asteroids[j].dx;
+        motion[j].dy = asteroids[j].dy;
+    }
+    for (c = 0; c < cells; c++)
+    {
+        cellStart[c + 1] = cellStart[c + 1] + cellStart[c];
+        cellFill[c] = cellStart[c];
+    }
+    for (j = 0; j < nAsteroids; j++)
+        if (asteroidCell[j] >= 0)
+        {
+            c = cellFill[asteroidCell[j]]++;
+            cellItems[c] = j;
+            cellX[c] = (float)motion[j].x;
+            cellY[c] = (float)motion[j].y;
+            cellDx[c] = (float)motion[j].dx;
+            cellDy[c] = (float)motion[j].dy;
+        }
+
+    return 1;
+}
+
+static double wrapDelta(double d, double size)
+{
+    /* shortest signed distance across a field that wraps at size */
+
+    if (d > size / 2)
+        return d - size;
+    if (d < -size / 2)
+        return d + size;
+    return d;
+}
+
+static void gatherRun(Flock *f, int self, int from, int to, float x, float y, float r2)
+{
+    /*
+     *	add the asteroids at cellItems[from .. to) within sqrt(r2) of
+     *	asteroid self to f; x, y is its position less the shift that
+     *	unwraps the run
+     */
+
+    float n = 0, ax = 0, ay = 0, px = 0, py = 0, sx = 0, sy = 0, ox, oy, d2, near, close;
+    int item;
+
+    for (item = from; item < to; item++)
+    {
+        ox = cellX[item] - x;
+        oy = cellY[item] - y;
+        d2 = ox * ox + oy * oy;
+        /* branch free: near and close weight each term by 0 or 1; the
+           disc's edge falls among the candidates, and branching on it
+           mispredicts on every other one */
+        near = (float)((item != self) & (d2 <= r2));
+        close = near * (float)((d2 < (float)(SEPARATION_RADIUS * SEPARATION_RADIUS)) & (d2 > 0));
+
+        n = n + near;
+        ax = ax + near * cellDx[item];
+        ay = ay + near * cellDy[item];
+        px = px + near * ox;
+        py = py + near * oy;
+        close = close / (d2 + (float)(d2 == 0));
+        sx = sx - close * ox;
+        sy = sy - close * oy;
+    }
+    f->n = f->n + n;
+    f->ax = f->ax + ax;
+    f->ay = f->ay + ay;
+    f->px = f->px + px;
+    f->py = f->py + py;
+    f->sx = f->sx + sx;
+    f->sy = f->sy + sy;
+}
+
+static void gatherCells(Flock *f, int self, int row, int col0, int col1, float x, float y,
+                        float r2)
+{
+    /*
+     *	gather from cells col0 .. col1 of row, any of which may lie past
+     *	the edges; cells are stored row by row, so the range is one run of
+     *	cellItems, split in two where it wraps
+     */
+
+    int base, lo, hi;
+
+    if (row < 0)
+    {
+        row = row + cellRows;
+        y = y + yMax;
+    }
+    else if (row >= cellRows)
+    {
+        row = row - cellRows;
+        y = y - yMax;
+    }
+    base = row * cellCols;
+
+    if (cellCols == 1)
+    {
+        gatherRun(f, self, cellStart[base], cellStart[base + 1], x, y, r2);
+        return;
+    }
+    if (col0 < 0)
+    {
+        hi = col1 < 0 ? col1 + cellCols : cellCols - 1;
+        gatherRun(f, self, cellStart[base + col0 + cellCols], cellStart[base + hi + 1],
+                  x + xMax, y, r2);
+        col0 = 0;
+    }
+    if (col1 >= cellCols)
+    {
+        lo = col0 >= cellCols ? col0 - cellCols : 0;
+        gatherRun(f, self, cellStart[base + lo], cellStart[base + col1 - cellCols + 1],
+                  x - xMax, y, r2);
+        col1 = cellCols - 1;
+    }
+    if (col0 <= col1)
+        gatherRun(f, self, cellStart[base + col0], cellStart[base + col1 + 1], x, y, r2);
+}
+
+void steerRange(int first, int last)
+{
+    /*
+     *	new velocities for the active asteroids in cells [first, last).
+     *	Neighbours are the asteroids within NEIGHBOUR_RADIUS, wrapping at
+     *	the edges, or in a crowd the nearest of them: the search covers m
+     *	rings of cells around the asteroid's own, m = 1, 2, ..., and stops
+     *	once the disc those rings are sure to cover holds NEIGHBOUR_LIMIT
+     *	asteroids.  The disc is centred on the asteroid, so the neighbours
+     *	kept lie in every direction alike:
+     *	  flock     align with and move toward neighbours, keep apart
+     *	  separate  keep apart only
+     *	  home      head for the ship, keep apart
+     */
+
+    int i, c, m, o, cx, cy, row, rowLo, rowHi, base, lo, hi, nRuns;
+    int runStart[6], runEnd[6];
+    float x, y, r2, shiftX[6], shiftY[6];
+    double ox, oy, d2, ex, ey, reach, vx, vy, speed;
+    Boid *a;
+    Flock f;
+
+    for (c = first; c < last; c++)
+    {
+        if (cellStart[c] == cellStart[c + 1])
+            continue;
+
+        /* rings 0 and 1 make up the 3 x 3 block around c, which ends
+           nearly every search; each of its rows is one run of cellItems,
+           split in two where it wraps, and the runs serve every asteroid
+           in c */
+        cx = c % cellCols;
+        cy = c / cellCols;
+        nRuns = 0;
+        for (o = cellRows > 1 ? -1 : 0; o <= (cellRows > 1 ? 1 : 0); o++)
+        {
+            row = cy + o;
+            shiftY[nRuns] = row < 0 ? -yMax : row >= cellRows ? yMax : 0;
+            row = row < 0 ? row + cellRows : row >= cellRows ? row - cellRows : row;
+            base = row * cellCols;
+            lo = cellCols > 1 ? cx - 1 : 0;
+            hi = cellCols > 1 ? cx + 1 : 0;
+            if (lo < 0)
+            {
+                shiftY[nRuns + 1] = shiftY[nRuns];
+                runStart[nRuns] = cellStart[base + cellCols - 1];
+                runEnd[nRuns] = cellStart[base + cellCols];
+                shiftX[nRuns++] = -xMax;
+                lo = 0;
+            }
+            if (hi >= cellCols)
+            {
+                shiftY[nRuns + 1] = shiftY[nRuns];
+                runStart[nRuns] = cellStart[base];
+                runEnd[nRuns] = cellStart[base + 1];
+                shiftX[nRuns++] = xMax;
+                hi = cellCols - 1;
+            }
+            runStart[nRuns] = cellStart[base + lo];
+            runEnd[nRuns] = cellStart[base + hi + 1];
+            shiftX[nRuns++] = 0;
+        }
+
+        for (i = cellStart[c]; i < cellStart[c + 1]; i++)
+        {
+            a = &motion[cellItems[i]];
+            x = cellX[i];
+            y = cellY[i];
+            /* m rings reach at least m cells past the asteroid's nearest
+               edge of its own cell, in each direction the grid divides */
+            ex = fmin(x - cx * cellW, (cx + 1) * cellW - x);
+            ey = fmin(y - cy * cellH, (cy + 1) * cellH - y);
+            ex = cellCols > 1 ? fmax(ex, 0) : NEIGHBOUR_RADIUS;
+            ey = cellRows > 1 ? fmax(ey, 0) : NEIGHBOUR_RADIUS;
+            for (m = 1;; m++)
+            {
+                reach = fmin(m * cellW + ex, m * cellH + ey);
+                r2 = reach < NEIGHBOUR_RADIUS ? reach * reach
+                                              : NEIGHBOUR_RADIUS * NEIGHBOUR_RADIUS;
+                f.n = f.ax = f.ay = f.px = f.py = f.sx = f.sy = 0;
+                for (o = 0; o < nRuns; o++)
+                    gatherRun(&f, i, runStart[o], runEnd[o], x - shiftX[o], y - shiftY[o], r2);
+                for (o = 2; o <= m; o++)
+                {
+                    if (cellRows > 1)
+                    {
+                        gatherCells(&f, i, cy - o, cx - o, cx + o, x, y, r2);
+                        gatherCells(&f, i, cy + o, cx - o, cx + o, x, y, r2);
+                    }
+                    if (cellCols > 1)
+                    {
+                        rowLo = cellRows > 1 ? cy - o + 1 : cy;
+                        rowHi = cellRows > 1 ? cy + o - 1 : cy;
+                        for (row = rowLo; row <= rowHi; row++)
+                        {
+                            gatherCells(&f, i, row, cx - o, cx - o, x, y, r2);
+                            gatherCells(&f, i, row, cx + o, cx + o, x, y, r2);
+                        }
+                    }
+                }
+                /* a disc that held too few is searched again, wider */
+                if (f.n >= NEIGHBOUR_LIMIT || reach >= NEIGHBOUR_RADIUS)
+                    break;
+            }
+
+            vx = a->dx + 0.05 * f.sx;
+            vy = a->dy + 0.05 * f.sy;
+            if (behaviour == BEHAVIOUR_FLOCK && f.n > 0)
+            {
+                vx = vx + 0.05 * (f.ax / f.n - a->dx) + 0.002 * f.px / f.n;
+                vy = vy + 0.05 * (f.ay / f.n - a->dy) + 0.002 * f.py / f.n;
+            }
+            else if (behaviour == BEHAVIOUR_HOME)
+            {
+                ox = wrapDelta(ship.x - a->x, xMax);
+                oy = wrapDelta(ship.y - a->y, yMax);
+                d2 = sqrt(ox * ox + oy * oy);
+                if (d2 > 0)
+                {
+                    vx = vx + 0.02 * ox / d2;
+                    vy = vy + 0.02 * oy / d2;
+                }
+            }
+
+            speed = sqrt(vx * vx + vy * vy);
+            if (speed > ASTEROID_SPEED_MAX)
+            {
+                vx = vx * ASTEROID_SPEED_MAX / speed;
+                vy = vy * ASTEROID_SPEED_MAX / speed;
+            }
+            steerDx[cellItems[i]] = vx;
+            steerDy[cellItems[i]] = vy;
+        }
+    }
+}
+
+/* -- frame-budget governor ------------------------------------------------- */
+
+void updateGovernor(double ms)
+{
+    /*
+     *	fold the work time of the last frame into a moving average and
+     *	scale cosmetic detail against the frame budget; detail backs off
+     *	quickly when over budget and creeps back while there is headroom
+     */
+
+    frameTime = frameTime * 0.9 + ms * 0.1;
+
+    if (frameTime > frameBudget)
+        detail = detail * 0.9;
+    else if (frameTime < frameBudget * 0.75)
+        detail = detail + 0.02;
+
+    if (detail < DETAIL_MIN)
+        detail = DETAIL_MIN;
+    if (detail > 1.0)
+        detail = 1.0;
+
+    frameTimeUs = (unsigned int)(frameTime * 1000.0);
+    detailPermille = (unsigned int)(detail * 1000.0);
+
+    nStarsVisible = (int)(nStars * detail);
+    blastPoints = (int)(BLAST_POINTS * detail);
+    if (blastPoints < 1)
+        blastPoints = 1;
+    debrisPoints = (int)ceil(DEBRIS_POINTS * detail);
+
+    /* outline LOD: keep every vertex, every other one or every fourth */
+    if (detail >= 0.75)
+        vertexStride = 1;
+    else if (detail >= 0.4)
+        vertexStride = 2;
+    else
+        vertexStride = 4;
+}
+
+/* -- helper function ------------------------------------------------------- */
+
+double
+myRandom(double min, double max)
+{
+    double d;
+
+    /* return a random number uniformly draw from [min,max] */
+    d = min + (max - min) * (rand() % 0x7fff) / 32767.0;
+
+    return d;
+}
+
+double myClock()
+{
+    /* return a monotonic timestamp in milliseconds */
+#ifdef _WIN32
+    return (double)glutGet(GLUT_ELAPSED_TIME);
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1.0e6;
+#endif
+}
+
+void sleepMs(double ms)
+{
+    struct timespec ts;
+
+    ts.tv_sec = (time_t)(ms / 1000.0);
+    ts.tv_nsec = (long)((ms - ts.tv_sec * 1000.0) * 1.0e6);
+    nanosleep(&ts, NULL);
+}
+
+void drawBitmapText(char *string, float x, float y)
+{
+    char *c;
+    if (headless)
+        return;
+    glRasterPos2f(x, y);
+
+    for (c = string; *c != '.'; c++)
+    {
+        glutBitmapCharacter(GLUT_BITMAP_9_BY_15, *c);
+    }
+}
+
+void drawBitmapString(char *string, float x, float y)
+{
+    /* like drawBitmapText, but for strings that may contain '.' */
+    char *c;
+    if (headless)
+        return;
+    glRasterPos2f(x, y);
+
+    for (c = string; *c != '\0'; c++)
+    {
+        glutBitmapCharacter(GLUT_BITMAP_8_BY_13, *c);
     }
 }
@@ -0,0 +1,65 @@
+/*
+ *	telemetry.h
+ *   Layout of the live statistics a running game publishes in POSIX shared
+ *   memory, shared by asteroids.c (the writer) and asteroids-stat.c (a
+ *   reader).  The game rewrites the block once per simulation tick under a
+ *   sequence lock: seq is odd while an update is in progress, so a reader
+ *   copies the block and retries until it saw the same even seq on both
+ *   sides of the copy.  Bump TELEMETRY_VERSION whenever the layout changes.
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#define TELEMETRY_MAGIC 0x52545341u /* "ASTR" */
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_NAME "/asteroids.%d" /* formatted with the game's pid */
+
+typedef struct
+{
+    uint32_t magic, version, size, pid;
+    atomic_uint seq;
+
+    uint64_t tick;
+    double tickRate;  /* ticks per second, smoothed */
+    double tickTime;  /* ms spent in the last tick */
+    double frameTime; /* ms of draw work per frame, smoothed */
+    double detail;    /* governor detail level in [0, 1] */
+
+    uint32_t asteroids, asteroidsActive;
+    uint32_t photons, photonsActive; /* photon pool size and occupancy */
+    uint32_t stars;
+    int32_t killCount;
+    uint32_t shipDestroyed;
+
+    uint64_t collisionPairs; /* pair tests in the last tick */
+    uint64_t collisionHits;  /* pairs found touching in the last tick */
+
+    uint32_t captureQueued, captureQueueSize; /* capture queue occupancy */
+    uint64_t captureWritten, captureDropped;
+} TelemetryStats;
+
+static inline void telemetryRead(const TelemetryStats *shared, TelemetryStats *out)
+{
+    /* take a consistent copy of the block, retrying while it is written */
+
+    unsigned int before, after;
+
+    for (;;)
+    {
+        before = atomic_load_explicit((atomic_uint *)&shared->seq, memory_order_acquire);
+        if (before & 1)
+            continue;
+        memcpy(out, shared, sizeof(TelemetryStats));
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit((atomic_uint *)&shared->seq, memory_order_relaxed);
+        if (before == after)
+            return;
+    }
+}
+
+#endif